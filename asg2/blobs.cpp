@@ -0,0 +1,66 @@
+// $Id: blobs.cpp,v 1.1 $
+
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+#include "blobs.h"
+#include "debug.h"
+#include "file_sys.h"
+
+blob_store::shard blob_store::shards[shard_count];
+
+// A blob whose last reference has gone can still be found for a
+// moment, expired, by an intern that then stores a new blob under
+// the same text.  So the entry is erased only if it is still this
+// blob's.
+void blob_store::release (const file_data* data, size_t hash) {
+   shard& home = shards[hash % shard_count];
+   {
+      lock_guard<mutex> guard (home.lock);
+      auto found = home.blobs.find ({hash, data->text()});
+      if (found != home.blobs.end()
+      and found->first.text.data() == data->text().data()) {
+         home.blobs.erase (found);
+      }
+   }
+   delete data;
+}
+
+blob_ptr blob_store::intern (file_data&& data) {
+   if (data.text().empty()) return nullptr;
+   size_t hash = std::hash<string_view>() (data.text());
+   shard& home = shards[hash % shard_count];
+   lock_guard<mutex> guard (home.lock);
+   auto found = home.blobs.find ({hash, data.text()});
+   if (found != home.blobs.end()) {
+      if (blob_ptr shared = found->second.lock()) {
+         DEBUGF ('B', "shared " << shared->text().size() << " bytes");
+         return shared;
+      }
+      home.blobs.erase (found);
+   }
+   const file_data* stored = new file_data (move (data));
+   blob_ptr blob (stored, [hash] (const file_data* dead) {
+                     release (dead, hash);
+                  });
+   home.blobs.emplace (key {hash, stored->text()}, blob);
+   return blob;
+}
+
+blob_store::counts blob_store::usage() {
+   counts total;
+   for (shard& each: shards) {
+      lock_guard<mutex> guard (each.lock);
+      for (const auto& [k, blob]: each.blobs) {
+         long refs = blob.use_count();
+         if (refs == 0) continue;
+         ++total.blobs;
+         total.references += refs;
+         total.stored_bytes += k.text.size();
+         total.referenced_bytes += refs * k.text.size();
+      }
+   }
+   return total;
+}
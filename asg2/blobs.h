@@ -0,0 +1,77 @@
+// $Id: blobs.h,v 1.1 $
+
+// blobs -
+//    The contents of plain files, stored once per distinct text.
+//    Trees made by scripts are full of files written with the same
+//    words, so a file holds a shared pointer to an immutable blob
+//    rather than a copy of its own.  Blobs are addressed by their
+//    contents:  writing a file hashes the new text and shares the
+//    blob already stored with that text, if there is one.  Since a
+//    blob never changes, the next write to any of the files that
+//    share it just points that file at another blob, which is all
+//    the copy on write there is.  A blob leaves the store when the
+//    last file, snapshot, or reader lets go of it.
+
+#ifndef __BLOBS_H__
+#define __BLOBS_H__
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+using namespace std;
+
+class file_data;
+using blob_ptr = shared_ptr<const file_data>;
+
+// blob_store -
+//    static class for the process wide store, split into shards by
+//    hash so that writes to different files seldom share a lock.
+// intern -
+//    Returns the stored blob with the same text as data, or stores
+//    data as a new blob and returns it.  Empty data is never stored,
+//    and comes back as nullptr.
+// usage -
+//    Counts the blobs, the references to them, the bytes of text
+//    stored, and the bytes that would be stored if every reference
+//    had its own copy.  Each shard is counted under its lock, but
+//    the shards are not all locked at once.
+//
+// Any thread may call these at any time.
+
+class blob_store {
+   public:
+      struct counts {
+         size_t blobs {0};
+         size_t references {0};
+         size_t stored_bytes {0};
+         size_t referenced_bytes {0};
+      };
+   private:
+      struct key {
+         size_t hash;
+         string_view text;
+         bool operator== (const key& that) const {
+            return hash == that.hash and text == that.text;
+         }
+      };
+      struct key_hash {
+         size_t operator() (const key& k) const { return k.hash; }
+      };
+      // Keyed by a view of the text of the blob it holds, so an entry
+      // is replaced, not just refilled, when its blob is.
+      struct shard {
+         mutex lock;
+         unordered_map<key,weak_ptr<const file_data>,key_hash> blobs;
+      };
+      static constexpr size_t shard_count = 16;
+      static shard shards[shard_count];
+      static void release (const file_data* data, size_t hash);
+   public:
+      static blob_ptr intern (file_data&& data);
+      static counts usage();
+};
+
+#endif
+
@@ -1,35 +1,153 @@
 // $Id: commands.cpp,v 1.16 2016-01-14 16:10:40-08 - - $
 
+#include "blobs.h"
 #include "commands.h"
+#include "dcache.h"
 #include "debug.h"
+#include "epoch.h"
+#include "frozen.h"
+#include "hostfs.h"
+#include "inodes.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "workpool.h"
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
 #include <stack>
 
-command_hash cmd_hash {
-   {"cat"   , fn_cat   },
-   {"cd"    , fn_cd    },
-   {"echo"  , fn_echo  },
-   {"exit"  , fn_exit  },
-   {"ls"    , fn_ls    },
-   {"lsr"   , fn_lsr   },
-   {"make"  , fn_make  },
-   {"mkdir" , fn_mkdir },
-   {"prompt", fn_prompt},
-   {"pwd"   , fn_pwd   },
-   {"rm"    , fn_rm    },
-   {"rmr"   , fn_rmr   },
+// builtin_commands -
+//    The fixed command set.  A perfect hash over it is found at
+//    compile time, so looking up a builtin costs one hash of the
+//    length and first and last chars, one probe, and one compare.
+
+struct command_entry {
+   string_view name;
+   command_fn fn;
+};
+
+constexpr command_entry builtin_commands[] {
+   {"cat"     , fn_cat     },
+   {"cd"      , fn_cd      },
+   {"du"      , fn_du      },
+   {"echo"    , fn_echo    },
+   {"exit"    , fn_exit    },
+   {"export"  , fn_export  },
+   {"import"  , fn_import  },
+   {"load"    , fn_load    },
+   {"ls"      , fn_ls      },
+   {"lsr"     , fn_lsr     },
+   {"make"    , fn_make    },
+   {"mkdir"   , fn_mkdir   },
+   {"mount"   , fn_mount   },
+   {"prompt"  , fn_prompt  },
+   {"pwd"     , fn_pwd     },
+   {"rm"      , fn_rm      },
+   {"rmr"     , fn_rmr     },
+   {"save"    , fn_save    },
+   {"snapshot", fn_snapshot},
+   {"stats"   , fn_stats   },
+};
+
+constexpr size_t cmd_slot_bits = 5;
+constexpr size_t cmd_slots = size_t (1) << cmd_slot_bits;
+static_assert (size (builtin_commands) <= cmd_slots,
+               "too many builtin commands for the dispatch table");
+
+constexpr size_t cmd_slot (uint32_t seed, string_view name) {
+   uint32_t key = uint32_t (name.size())
+                | uint32_t (uint8_t (name.front())) << 8
+                | uint32_t (uint8_t (name.back())) << 16;
+   return uint32_t ((key ^ seed) * 0x9E3779B1u) >> (32 - cmd_slot_bits);
+}
+
+// Tries seeds until every builtin lands in its own slot.  Zero
+// means none did, which happens if two builtins share a length and
+// first and last chars.
+constexpr uint32_t find_cmd_seed() {
+   for (uint32_t seed = 1; seed < (1u << 16); ++seed) {
+      bool used[cmd_slots] {};
+      bool perfect = true;
+      for (const auto& entry: builtin_commands) {
+         size_t slot = cmd_slot (seed, entry.name);
+         if (used[slot]) { perfect = false; break; }
+         used[slot] = true;
+      }
+      if (perfect) return seed;
+   }
+   return 0;
+}
+
+constexpr uint32_t cmd_seed = find_cmd_seed();
+static_assert (cmd_seed != 0, "no perfect hash for builtin_commands");
+
+struct command_table {
+   command_entry slots[cmd_slots];
 };
 
-command_fn find_command_fn (const string& cmd) {
-   // Note: value_type is pair<const key_type, mapped_type>
-   // So: iterator->first is key_type (string)
-   // So: iterator->second is mapped_type (command_fn)
-   const auto result = cmd_hash.find (cmd);
-   if (result == cmd_hash.end()) {
-      throw command_error (cmd + ": no such function");
+constexpr command_table make_command_table() {
+   command_table table {};
+   for (const auto& entry: builtin_commands) {
+      table.slots[cmd_slot (cmd_seed, entry.name)] = entry;
+   }
+   return table;
+}
+
+constexpr command_table cmd_table = make_command_table();
+
+// Commands added by register_command.  Only looked at when the
+// name is not a builtin, so an empty map costs nothing.
+command_hash extra_commands;
+
+command_fn find_command_fn (string_view command) {
+   if (not command.empty()) {
+      const command_entry& entry =
+            cmd_table.slots[cmd_slot (cmd_seed, command)];
+      if (entry.name == command) return entry.fn;
+   }
+   if (extra_commands.empty()) return nullptr;
+   const auto result = extra_commands.find (string (command));
+   return result == extra_commands.end() ? nullptr : result->second;
+}
+
+bool register_command (string_view command, command_fn fn) {
+   if (command.empty() or fn == nullptr) return false;
+   if (find_command_fn (command) != nullptr) return false;
+   extra_commands.emplace (string (command), fn);
+   DEBUGF ('c', "registered " << command);
+   return true;
+}
+
+// A file_error that a command lets through is reported like any
+// other error, rather than ending every session in the server.
+void execute (inode_state& state, const viewvec& words) {
+   command_fn fn = find_command_fn (words[0]);
+   if (fn == nullptr) {
+      complain (state.errors()) << words[0] << ": no such function"
+                                << endl;
+      return;
    }
-   return result->second;
+   epoch::guard pinned;
+   unique_lock<mutex> ordered = journal::hold (words);
+   shared_lock<shared_mutex> changing = frozen::hold (words[0]);
+   try {
+      fn (state, words);
+   }catch (command_error& error) {
+      complain (state.errors()) << error.what() << endl;
+      return;
+   }catch (file_error& error) {
+      complain (state.errors()) << words[0] << ": " << error.what()
+                                << endl;
+      return;
+   }
+   if (journal::is_open()) journal::record (state, words);
 }
 
+// The pool that lsr, import, and export share, if -j asked for
+// more than one thread.
+static unique_ptr<work_pool> worker_pool;
+
 command_error::command_error (const string& what):
             runtime_error (what) {
 }
@@ -40,167 +158,344 @@ int exit_status_message() {
    return exit_status;
 }
 
-void fn_cat (inode_state& state, const wordvec& words){
+void fn_cat (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   string filename = *(words.end()-1);
-   inode_ptr ogcwd = state.getCwd();
-   inode_ptr res = resolvePath(words[1], state.getCwd());
+   if (words.size() < 2) return;
+   string filename (*(words.end()-1));
+   // The file is read under the lock of the directory it is in.
+   auto pathparts = split_last (words[1]);
+   inode* dir = resolvePath(pathparts.first, state.getCwd());
+   if (dir == nullptr or not dir->isDirectory()){
+      throw command_error ("cat: " + filename + ": file does not exist");
+   }
+   if (pathparts.second.empty()) return;
+   read_lock guard (dir->getContents()->getLock());
+   inode* res = dir->getContents()->getNode(
+                name_table::find (pathparts.second));
    if (res == nullptr){
       throw command_error ("cat: " + filename + ": file does not exist");
       return; }
    if (res->isDirectory()) return; //error here
-   cout << res->getContents()->readfile() << endl;
+   state.output() << res->getContents()->readfile() << '\n';
 }
 
-void fn_cd (inode_state& state, const wordvec& words){
+void fn_cd (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   inode_ptr ogcwd = state.getCwd();
+   inode* ogcwd = state.getCwd();
    if (words.size() == 1){
       state.setCwd(state.getRoot()->getContents()->getNode("/"));
       return;
    }
    if (words.size() > 2) return;
    if (ogcwd == state.getRoot()->getContents()->getNode("/") && words[1] == "..") return;
-   inode_ptr res = resolvePath(words[1], state.getCwd());
+   inode* res = resolvePath(words[1], state.getCwd());
    if (res == nullptr) return;
    if (!res->isDirectory()) return;
    state.setCwd(res);
 }
 
-void fn_echo (inode_state& state, const wordvec& words){
+// A mounted snapshot keeps no totals, since they would change with
+// the tree it was taken of, so du adds it up the way the totals
+// are kept:  each directory counts 2, and each dirent 1 more than
+// a plain file's size.
+static size_t snapshot_total (inode* top){
+   size_t total = 0;
+   tree_walker walker (top, "");
+   for (inode* dir = walker.next(); dir != nullptr; dir = walker.next()) {
+      base_file* contents = dir->getContents();
+      total += 2;
+      for (const string& name: contents->getAllPaths()) {
+         inode* node = contents->getNode (name);
+         if (node == nullptr or node->getParent() != dir) continue;
+         total += 1 + (node->isDirectory() ? 0 : node->getTotal());
+      }
+   }
+   return total;
+}
+
+// du -
+//    Prints the total size of a file or subtree, which every inode
+//    keeps up to date, so this costs nothing but the lookup.  A
+//    directory in a mounted snapshot is walked instead.
+void fn_du (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   string path (words.size() > 1 ? words[1] : ".");
+   inode* res = resolvePath(path, state.getCwd());
+   if (res == nullptr) {
+      throw command_error ("du: " + path + ": no such file or directory");
+   }
+   size_t total = res->isDirectory() and res->getContents()->isReadOnly()
+                ? snapshot_total (res) : res->getTotal();
+   state.output() << total << '\t' << path << '\n';
+}
+
+void fn_echo (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   cout << word_range (words.cbegin() + 1, words.cend()) << endl;
+   state.output() << view_range (words.cbegin() + 1, words.cend())
+                  << '\n';
 }
 
-void fn_exit (inode_state& state, const wordvec& words){
+void fn_exit (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
    throw ysh_exit();
 }
 
-void fn_ls (inode_state& state, const wordvec& words){
+void fn_export (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   inode_ptr ogcwd = state.getCwd();
-   inode_ptr res = ogcwd;
+   if (words.size() < 3) {
+      throw command_error ("export: missing operand");
+   }
+   string path (words[1]);
+   inode* dir = resolvePath (path, state.getCwd());
+   if (dir == nullptr or not dir->isDirectory()) {
+      throw command_error ("export: " + path + ": no such directory");
+   }
+   try {
+      size_t count = host_tree::export_dir (worker_pool.get(), dir,
+                                            string (words[2]));
+      DEBUGF ('c', "exported " << count);
+   }catch (file_error& error) {
+      throw command_error (string ("export: ") + error.what());
+   }
+}
+
+// The directory imported into is made if it does not exist.
+void fn_import (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if (words.size() < 3) {
+      throw command_error ("import: missing operand");
+   }
+   string hostdir (words[1]);
+   if (not host_tree::is_dir (hostdir)) {
+      throw command_error ("import: " + hostdir + ": not a directory");
+   }
+   string path (words[2]);
+   inode* dir = resolvePath (path, state.getCwd());
+   if (dir == nullptr) {
+      auto pathparts = split_last (path);
+      inode* res = resolvePath (pathparts.first, state.getCwd());
+      if (res != nullptr and res->isDirectory()
+          and not pathparts.second.empty()) {
+         write_lock guard (res->getContents()->getLock());
+         string name (pathparts.second);
+         dir = res->getContents()->getNode (name);
+         if (dir == nullptr) dir = res->getContents()->mkdir (name);
+      }
+   }
+   if (dir == nullptr or not dir->isDirectory()) {
+      throw command_error ("import: " + path + ": no such directory");
+   }
+   if (dir->getContents()->isReadOnly()) {
+      throw command_error ("import: " + path + ": read-only file system");
+   }
+   try {
+      size_t count = host_tree::import_dir (worker_pool.get(),
+                                            hostdir, dir);
+      DEBUGF ('c', "imported " << count);
+   }catch (file_error& error) {
+      throw command_error (string ("import: ") + error.what());
+   }
+}
+
+void fn_load (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if (words.size() < 2) {
+      throw command_error ("load: missing operand");
+   }
+   try {
+      snapshot::load (state, string (words[1]));
+   }catch (file_error& error) {
+      throw command_error (string ("load: ") + error.what());
+   }
+}
+
+// A removed cwd keeps the path it had, so ls and lsr of it still
+// have something to print.
+static string path_of (inode_state& state, inode* dir){
+   return dir == state.getCwd() ? state.getCwdPath() : dir->getFullPath();
+}
+
+void fn_ls (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   inode* res = state.getCwd();
    if(words.size() > 1)
       res = resolvePath(words[1], state.getCwd());
    if (res == nullptr) return;
-   auto pathList = res->getContents()->getAllPaths();
-   state.setCwd(res);
-   fn_pwd(state, words);
-   for (size_t i = 0; i < pathList.size(); i++){
-      cout << pathList[i] << endl;
+   if (not res->isDirectory()) {
+      throw command_error ("ls: " + string (words[1]) + ": not a directory");
    }
-   state.setCwd(ogcwd);
+   print_listing (state.output(), res, path_of (state, res));
 }
 
-void fn_lsr (inode_state& state, const wordvec& words){
+// lsr -
+//    Streams the subtree in the same order a recursive ls would
+//    print it, without touching the cwd or copying any dirents.
+//    With a pool it renders subtrees in parallel.
+
+static constexpr size_t lsr_fanout_depth = 3;
+static void print_subtree (ostream& out, inode* root,
+                           const string& path);
+static void parallel_lsr (ostream& out, inode* root,
+                          const string& path);
+
+void fn_lsr (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+   inode* res = state.getCwd();
+   if (words.size() > 1)
+      res = resolvePath(words[1], state.getCwd());
+   if (res == nullptr) return;
+   if (not res->isDirectory()) {
+      throw command_error ("lsr: " + string (words[1]) + ": not a directory");
+   }
+   if (worker_pool != nullptr) {
+      parallel_lsr (state.output(), res, path_of (state, res));
+   }else {
+      print_subtree (state.output(), res, path_of (state, res));
+   }
+}
 
-   inode_ptr ogcwd = state.getCwd();
-   inode_ptr newCwd = ogcwd;
-   if (words.size() > 0){
-      newCwd = resolvePath(words[1], state.getCwd());
-      state.setCwd(newCwd);
+static void print_subtree (ostream& out, inode* root,
+                           const string& path){
+   tree_walker walker (root, path);
+   for (inode* dir = walker.next(); dir != nullptr; dir = walker.next()) {
+      print_listing (out, dir, walker.path());
    }
-   auto pathList = newCwd->getContents()->getAllDirs();
-   wordvec ls {"ls"};
-   fn_ls(state, ls);
-   for(int i = 0; i < pathList.size(); i++){
-      DFS(pathList[i], state);
+}
+
+// Each task renders one directory into its own buffer and fans its
+// subdirectories out to the pool.  The tasks take no lock and no
+// pin of their own:  the command is pinned while it waits, so
+// nothing they find is freed before they are done.  Below
+// lsr_fanout_depth a task renders its whole subtree serially
+// instead.  Once every task is done the buffers are written out in
+// preorder, which is exactly the order print_subtree uses.
+struct lsr_task {
+   inode* dir;
+   size_t depth;
+   string path;
+   string text;
+   vector<unique_ptr<lsr_task>> children;
+};
+
+static void render_lsr_task (task_group& group, lsr_task& task){
+   ostringstream out;
+   if (task.depth >= lsr_fanout_depth) {
+      print_subtree (out, task.dir, task.path);
+   }else {
+      vector<inode*> subdirs;
+      print_listing (out, task.dir, task.path);
+      task.dir->getContents()->getSubdirs (subdirs);
+      string prefix = task.path == "/" ? "/" : task.path + "/";
+      for (inode* subdir: subdirs) {
+         task.children.push_back (make_unique<lsr_task> (
+               lsr_task {subdir, task.depth + 1,
+                         prefix + subdir->getName(), {}, {}}));
+         lsr_task* child = task.children.back().get();
+         worker_pool->submit (group, [&group, child] {
+            render_lsr_task (group, *child);
+         });
+      }
    }
-   state.setCwd(ogcwd);
+   task.text = out.str();
 }
 
-void DFS(string s, inode_state& state){
-   wordvec newLs {"ls", s};
-   fn_ls(state, newLs);
-   auto dirList = state.getCwd()->getContents()->getAllDirs();
-   if (dirList.size() == 0)
-      return;
-   map<string, int> disc;
-   for (int i = 0; i < dirList.size(); i++){
-      disc[dirList[i]] = 0;
-   }
-   for (auto it = disc.begin(); it != disc.end(); ++it){
-      if (it->second == 0){
-     	disc[it->first] = 1;
-     	inode_ptr ogcwd = state.getCwd();
-     	state.setCwd(state.getCwd()->getContents()->getNode(it->first));
-     	DFS(it->first, state);
-     	state.setCwd(ogcwd);
+static void parallel_lsr (ostream& out, inode* root,
+                          const string& path){
+   lsr_task top {root, 0, path, {}, {}};
+   task_group group;
+   worker_pool->submit (group, [&group, &top] {
+      render_lsr_task (group, top);
+   });
+   worker_pool->wait (group);
+   vector<const lsr_task*> stack {&top};
+   while (not stack.empty()) {
+      const lsr_task* task = stack.back();
+      stack.pop_back();
+      out << task->text;
+      for (auto child = task->children.rbegin();
+           child != task->children.rend(); ++child) {
+         stack.push_back (child->get());
       }
- 	}
+   }
+}
+
+void set_worker_threads (size_t threads){
+   worker_pool = threads > 1 ? make_unique<work_pool> (threads) : nullptr;
+}
+
+void print_listing (ostream& out, inode* dir, const string& path){
+   out << path << '\n';
+   dir->getContents()->printNames (out);
 }
 
-void fn_make (inode_state& state, const wordvec& words){
+// The last component of the path of a file or directory to be
+// made, which is its name.  A path that ends in a slash, or has no
+// last component, would make a dirent with no name.
+static string new_name (string_view command, string_view path){
+   string_view name = split_last (path).second;
+   if (name.empty() or path.back() == '/') {
+      throw command_error (string (command) + ": " + string (path)
+                           + ": invalid name");
+   }
+   return string (name);
+}
+
+void fn_make (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   if (words.size() <= 0){
-      cout << "mkdir: missing operand" << endl;
+   if (words.size() < 2){
+      state.output() << "make: missing operand" << '\n';
       return;
    }
-   wordvec newData(words.begin()+2, words.end());
+   file_data newData(words.begin()+2, words.end());
 
-   wordvec pathvec = split (words[1], "/");
-   string fullpath = "";
-   string filename = *(pathvec.end()-1);
-   for (auto it = pathvec.begin(); it != pathvec.end()-1; ++it)
-      fullpath += (*it + "/");
-   inode_ptr res = resolvePath(fullpath, state.getCwd()); //resulting path before filename
+   auto pathparts = split_last (words[1]);
+   string filename = new_name ("make", words[1]);
+   inode* res = resolvePath(pathparts.first, state.getCwd()); //resulting path before filename
    if (res == nullptr) return;
-   inode_ptr file = res->getContents()->getNode(filename); //search directory for filename if existing
+   write_lock guard (res->getContents()->getLock());
+   inode* file = res->getContents()->getNode(filename); //search directory for filename if existing
    if (file != nullptr && res != nullptr) {
       if(file->isDirectory()) //getContents()->getNode(words[1])
          return;
-      file->getContents()->writefile(newData);
+      file->getContents()->writefile(move (newData));
       return;
    }
-   res->getContents()->mkfile(filename);
-   res->getContents()->getNode(filename)->getContents()->writefile(newData);
+   res->getContents()->mkfile(filename)->getContents()->writefile(move (newData));
 
-   inode_ptr ogcwd = state.getCwd();
    //inode_ptr newFile = state.getCwd()->getContents()->mkfile(words[1]);
    //wordvec newData(words.begin()+2, words.end());
    //newFile->getContents()->writefile(newData);
 }
 
-void fn_mkdir (inode_state& state, const wordvec& words){
+void fn_mkdir (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
-   if (words.size() <= 0){
-      cout << "mkdir: missing operand" << endl;
+   if (words.size() < 2){
+      state.output() << "mkdir: missing operand" << '\n';
       return;
    }
-   //root case?
-   if (words[1] == "/"){
-      inode_ptr ogcwd = state.getCwd();
-      auto root = state.getCwd()->getContents()->mkdir(words[1]);
-      root->getContents()->setPath("..", ogcwd);
-      root->getContents()->setPath(".", root);
-      return;
-   }
-
-   wordvec pathvec = split(words[1], "/");
-   string dirname = *(pathvec.end()-1);
-   string fullpath = "";
-   for (auto it = pathvec.begin(); it != pathvec.end()-1; ++it)
-      fullpath += (*it + "/");
-   inode_ptr res = resolvePath(fullpath,state.getCwd());
+   auto pathparts = split_last (words[1]);
+   string dirname = new_name ("mkdir", words[1]);
+   inode* res = resolvePath(pathparts.first,state.getCwd());
    if (res == nullptr) return;
-   inode_ptr directory = res->getContents()->getNode(dirname);
+   write_lock guard (res->getContents()->getLock());
+   inode* directory = res->getContents()->getNode(dirname);
    if (directory != nullptr && res != nullptr) //if filename exists and path exists
       //dont overwrite anything (ie file or directory)
       return;
-   inode_ptr dir = res->getContents()->mkdir(dirname);
-   dir->getContents()->setPath("..", res);
-   dir->getContents()->setPath(".",res->getContents()->getNode(dirname));
+   res->getContents()->mkdir(dirname);
 
    /*if (state.getCwd()->getContents()->getNode(filename) != nullptr)
       return; */
@@ -214,39 +509,66 @@ void fn_mkdir (inode_state& state, const wordvec& words){
    */
 }
 
-void fn_prompt (inode_state& state, const wordvec& words){
+// The snapshot shows / as it is now.  Mounting the same snapshot
+// at more than one path is allowed, and each mount fills itself.
+void fn_mount (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if (words.size() < 3) {
+      throw command_error ("mount: missing operand");
+   }
+   string name (words[1]);
+   uint64_t generation;
+   if (not frozen::find (name, generation)) {
+      throw command_error ("mount: " + name + ": no such snapshot");
+   }
+   string path (words[2]);
+   auto pathparts = split_last (path);
+   string dirname (pathparts.second);
+   inode* res = resolvePath (pathparts.first, state.getCwd());
+   if (res == nullptr or not res->isDirectory() or dirname.empty()) {
+      throw command_error ("mount: " + path
+                           + ": no such file or directory");
+   }
+   inode* slash = state.getRoot()->getContents()->getNode ("/");
+   write_lock guard (res->getContents()->getLock());
+   if (res->getContents()->getNode (dirname) != nullptr) {
+      throw command_error ("mount: " + path + ": file exists");
+   }
+   res->getContents()->mount (dirname, slash, generation);
+}
+
+void fn_prompt (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   state.setPrompt(words[1]);
+   if (words.size() < 2) return;
+   state.setPrompt(string (words[1]));
 }
 
-void fn_pwd (inode_state& state, const wordvec& words){
+void fn_pwd (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   string pwd = state.getCwd()->getContents()->getPwd();
-   if (pwd.length() == 2){
-      cout << "/" << endl;
-   } else {
-      pwd = pwd.substr(2, pwd.length()-2);
-      cout << pwd << endl;
-   }
+   state.output() << state.getCwdPath() << '\n';
 }
 
-void fn_rm (inode_state& state, const wordvec& words){
+void fn_rm (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   if (words.size() <= 0) return; //error here?
-   wordvec pathvec = split(words[1],"/");
-   string fullpath = "";
-   string name = *(pathvec.end()-1);
-   for (auto it = pathvec.begin(); it != pathvec.end()-1; ++it)
-      fullpath += (*it + "/");
-   inode_ptr res = resolvePath(fullpath,state.getCwd());
+   if (words.size() < 2) return; //error here?
+   auto pathparts = split_last (words[1]);
+   string name (pathparts.second);
+   inode* res = resolvePath(pathparts.first,state.getCwd());
    if (res == nullptr) return; //error
-   inode_ptr rmfile = res->getContents()->getNode(name);
+   write_lock guard (res->getContents()->getLock());
+   inode* rmfile = res->getContents()->getNode(name);
+   // Dot and dotdot are not dirents, so there is nothing to remove.
+   if (rmfile != nullptr && rmfile->getParent() != res) return;
    if (res != nullptr && rmfile != nullptr){
       if(rmfile->isDirectory()){
-         if(rmfile->getContents()->getAllPaths().size() <= 2){
+         // Held for writing so that nothing is added to it between
+         // the check and its removal.
+         write_lock subdir (rmfile->getContents()->getLock());
+         if(rmfile->getContents()->size() <= 2){
             res->getContents()->remove(name);
             return;
          } else { return; /* not empty */ }}
@@ -260,21 +582,61 @@ void fn_rm (inode_state& state, const wordvec& words){
    */
 }
 
-void fn_rmr (inode_state& state, const wordvec& words){
+void fn_rmr (inode_state& state, const viewvec& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+   if (words.size() < 2) {
+      throw command_error ("rmr: missing operand");
+   }
+   auto pathparts = split_last (words[1]);
+   string name (pathparts.second);
+   if (name.empty() or name == "." or name == "..") {
+      throw command_error ("rmr: " + string (words[1]) + ": may not be removed");
+   }
+   inode* res = resolvePath(pathparts.first,state.getCwd());
+   if (res == nullptr or not res->isDirectory()) {
+      throw command_error ("rmr: " + string (words[1])
+                           + ": no such file or directory");
+   }
+   write_lock guard (res->getContents()->getLock());
+   if (res->getContents()->getNode(name) == nullptr) {
+      throw command_error ("rmr: " + string (words[1])
+                           + ": no such file or directory");
+   }
+   res->getContents()->rmtree(name);
 }
 
-inode_ptr resolvePath (const string& path, inode_ptr oldcwd){
-   wordvec temp = split (path, "/");
-
-   for(unsigned i=0; i < temp.size(); i++){
-      //if (!oldcwd->getContents()->getNode(temp[i])->isDirectory())
-         //return;
-      if (oldcwd == nullptr) return nullptr;
-      oldcwd = oldcwd->getContents()->getNode(temp[i]);
+// resolvePath -
+//    Walks path one component at a time starting from oldcwd.
+//    Components are views into path and are looked up by interned
+//    name id, so nothing is allocated.  A name that was never
+//    interned, or a component under a plain file, fails the walk.
+//    Results, including failures, are kept in the dentry_cache
+//    along with the directories the walk looked into.  Lookups
+//    take no lock, so the walk never waits on a writer, but the
+//    caller must be pinned to the epoch.
+inode* resolvePath (string_view path, inode* oldcwd){
+   if (oldcwd == nullptr) return nullptr;
+   inode* result;
+   uint64_t ticket;
+   if (dentry_cache::lookup (oldcwd, path, result, ticket)) return result;
+   static thread_local dentry_cache::deplist deps;
+   deps.clear();
+   result = oldcwd;
+   path_walker walker (path);
+   string_view component;
+   while (walker.next (component)) {
+      if (not result->isDirectory()) { result = nullptr; break; }
+      dentry_cache::depend (deps, result);
+      name_id name = name_table::find (component);
+      if (name == name_table::no_name) { result = nullptr; break; }
+      result = result->getContents()->getNode(name);
+      if (result == nullptr) break;
+   }
+   if (not deps.empty()) {
+      dentry_cache::insert (oldcwd, path, result, deps, ticket);
    }
-   return oldcwd;
+   return result;
 }
 
 /*
@@ -285,3 +647,63 @@ inode_ptr search (inode_ptr dir, const string& path){
    //search(inode_ptr)
 }
 */
+
+// With no name, lists the snapshots taken so far.
+void fn_snapshot (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if (words.size() < 2) {
+      for (const string& name: frozen::names()) {
+         state.output() << name << '\n';
+      }
+      return;
+   }
+   string name (words[1]);
+   if (not frozen::take (name)) {
+      throw command_error ("snapshot: " + name + ": snapshot exists");
+   }
+}
+
+// stats -
+//    Counts the inodes in use, from the inode_table rather than by
+//    walking the tree, so removed inodes still kept by snapshots or
+//    sessions are counted too.  Then reports how much the blob store
+//    saves by sharing file contents:  the bytes of text it holds,
+//    against the bytes it would hold if every file, kept snapshot
+//    version, and mounted copy had its own.
+void fn_stats (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   size_t dirs = 0;
+   size_t files = 0;
+   inode_table::scan ([&dirs, &files] (inode* node) {
+      ++(node->isDirectory() ? dirs : files);
+   });
+   state.output() << "inodes: " << dirs << " directories, " << files
+                  << " plain files, " << inode_table::limit() - 1
+                  << " numbers\n";
+   blob_store::counts usage = blob_store::usage();
+   double ratio = usage.stored_bytes == 0 ? 1.0
+                : double (usage.referenced_bytes) / usage.stored_bytes;
+   state.output() << "blobs: " << usage.blobs << " stored, "
+                  << usage.references << " references\n"
+                  << "bytes: " << usage.stored_bytes << " stored, "
+                  << usage.referenced_bytes << " referenced, "
+                  << usage.referenced_bytes - usage.stored_bytes
+                  << " saved\n"
+                  << "dedup ratio: " << fixed << setprecision (2)
+                  << ratio << defaultfloat << '\n';
+}
+
+void fn_save (inode_state& state, const viewvec& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if (words.size() < 2) {
+      throw command_error ("save: missing operand");
+   }
+   try {
+      snapshot::save (state, string (words[1]));
+   }catch (file_error& error) {
+      throw command_error (string ("save: ") + error.what());
+   }
+}
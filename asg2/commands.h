@@ -11,7 +11,7 @@ using namespace std;
 
 // A couple of convenient usings to avoid verbosity.
 
-using command_fn = void (*)(inode_state& state, const wordvec& words);
+using command_fn = void (*)(inode_state& state, const viewvec& words);
 using command_hash = unordered_map<string,command_fn>;
 
 // command_error -
@@ -24,24 +24,60 @@ class command_error: public runtime_error {
 };
 
 
-inode_ptr resolvePath (const string&, inode_ptr);
-void DFS(string s, inode_state& state);
+inode* resolvePath (string_view, inode*);
+
+// print_listing -
+//    Writes what ls shows for one directory:  its path, then its
+//    names one per line.  The caller supplies the path, which a
+//    walk can build as it goes, and is pinned to the epoch.
+void print_listing (ostream& out, inode* dir, const string& path);
+
+// set_worker_threads -
+//    With more than one thread, lsr renders subtrees in parallel on
+//    a work-stealing pool, and import and export read and write the
+//    host on it.  Output is identical to the serial walk.
+void set_worker_threads (size_t threads);
 // execution functions -
 
-void fn_cat    (inode_state& state, const wordvec& words);
-void fn_cd     (inode_state& state, const wordvec& words);
-void fn_echo   (inode_state& state, const wordvec& words);
-void fn_exit   (inode_state& state, const wordvec& words);
-void fn_ls     (inode_state& state, const wordvec& words);
-void fn_lsr    (inode_state& state, const wordvec& words);
-void fn_make   (inode_state& state, const wordvec& words);
-void fn_mkdir  (inode_state& state, const wordvec& words);
-void fn_prompt (inode_state& state, const wordvec& words);
-void fn_pwd    (inode_state& state, const wordvec& words);
-void fn_rm     (inode_state& state, const wordvec& words);
-void fn_rmr    (inode_state& state, const wordvec& words);
-
-command_fn find_command_fn (const string& command);
+void fn_cat    (inode_state& state, const viewvec& words);
+void fn_cd     (inode_state& state, const viewvec& words);
+void fn_du     (inode_state& state, const viewvec& words);
+void fn_echo   (inode_state& state, const viewvec& words);
+void fn_exit   (inode_state& state, const viewvec& words);
+void fn_export (inode_state& state, const viewvec& words);
+void fn_import (inode_state& state, const viewvec& words);
+void fn_load   (inode_state& state, const viewvec& words);
+void fn_ls     (inode_state& state, const viewvec& words);
+void fn_lsr    (inode_state& state, const viewvec& words);
+void fn_make   (inode_state& state, const viewvec& words);
+void fn_mkdir  (inode_state& state, const viewvec& words);
+void fn_mount  (inode_state& state, const viewvec& words);
+void fn_prompt (inode_state& state, const viewvec& words);
+void fn_pwd    (inode_state& state, const viewvec& words);
+void fn_rm     (inode_state& state, const viewvec& words);
+void fn_rmr    (inode_state& state, const viewvec& words);
+void fn_save   (inode_state& state, const viewvec& words);
+void fn_snapshot (inode_state& state, const viewvec& words);
+void fn_stats  (inode_state& state, const viewvec& words);
+
+// find_command_fn -
+//    Returns the function for a command, or nullptr if there is no
+//    such command.  Never throws.
+// register_command -
+//    Adds a command beyond the builtin set.  Returns false, and
+//    changes nothing, if the name is empty or already taken.
+
+command_fn find_command_fn (string_view command);
+bool register_command (string_view command, command_fn fn);
+
+// execute -
+//    Looks up and calls the function for one command line, which
+//    must have at least one word.  If there is a problem discovered
+//    in any function, an exn is thrown and printed here, on the
+//    state's error stream.  The command runs pinned to the epoch,
+//    and commands that complete are handed to the journal.
+
+void execute (inode_state& state, const viewvec& words);
 
 // exit_status_message -
 //    Prints an exit message and returns the exit status, as recorded
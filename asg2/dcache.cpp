@@ -0,0 +1,94 @@
+// $Id: dcache.cpp,v 1.1 $
+
+#include <iostream>
+
+using namespace std;
+
+#include "dcache.h"
+#include "debug.h"
+
+atomic<atomic<uint64_t>*> dentry_cache::stamps[max_chunks];
+atomic<uint64_t> dentry_cache::era {0};
+thread_local unordered_map<dentry_cache::key,dentry_cache::entry,
+                           dentry_cache::key_hash>
+      dentry_cache::entries;
+thread_local uint64_t dentry_cache::entries_era {0};
+thread_local dentry_cache::key dentry_cache::probe {nullptr, ""};
+
+// Each thread reuses its probe key for every lookup so that its
+// string keeps its capacity and a hit allocates nothing.
+dentry_cache::key& dentry_cache::make_probe (const inode* start,
+                                             string_view path) {
+   probe.start = start;
+   probe.path.assign (path.data(), path.size());
+   return probe;
+}
+
+// A directory whose stamp was never moved has no chunk yet.
+uint64_t dentry_cache::stamp (int inode_nr) {
+   const atomic<uint64_t>* chunk
+         = stamps[inode_nr >> chunk_bits].load (memory_order_acquire);
+   if (chunk == nullptr) return 0;
+   return chunk[inode_nr & (chunk_size - 1)]
+         .load (memory_order_acquire);
+}
+
+void dentry_cache::depend (deplist& deps, const inode* dir) {
+   int nr = dir->get_inode_nr();
+   deps.push_back ({nr, stamp (nr)});
+}
+
+bool dentry_cache::lookup (const inode* start, string_view path,
+                           inode*& result, uint64_t& ticket) {
+   ticket = era.load (memory_order_acquire);
+   if (entries_era != ticket) {
+      entries.clear();
+      entries_era = ticket;
+   }
+   auto found = entries.find (make_probe (start, path));
+   if (found == entries.end()) return false;
+   for (const dependency& dep: found->second.deps) {
+      if (stamp (dep.inode_nr) != dep.stamp) {
+         DEBUGF ('d', "stale " << path);
+         entries.erase (found);
+         return false;
+      }
+   }
+   DEBUGF ('d', "hit " << path << " = " << found->second.result);
+   result = found->second.result;
+   return true;
+}
+
+void dentry_cache::insert (const inode* start, string_view path,
+                           inode* result, const deplist& deps,
+                           uint64_t ticket) {
+   if (ticket != era.load (memory_order_acquire)) return;
+   if (entries.size() >= max_entries) entries.clear();
+   entries.insert_or_assign (make_probe (start, path),
+                             entry {result, deps});
+   DEBUGF ('d', "insert " << path << " = " << result);
+}
+
+// The first change to a directory in a chunk allocates the chunk.
+// Threads that race to do so keep whichever was stored first.
+void dentry_cache::invalidate (const inode* dir) {
+   int nr = dir->get_inode_nr();
+   atomic<atomic<uint64_t>*>& slot = stamps[nr >> chunk_bits];
+   atomic<uint64_t>* chunk = slot.load (memory_order_acquire);
+   if (chunk == nullptr) {
+      atomic<uint64_t>* fresh = new atomic<uint64_t>[chunk_size]();
+      if (slot.compare_exchange_strong (chunk, fresh,
+                                        memory_order_acq_rel)) {
+         chunk = fresh;
+      }else {
+         delete[] fresh;
+      }
+   }
+   chunk[nr & (chunk_size - 1)].fetch_add (1, memory_order_release);
+   DEBUGF ('d', "invalidate " << dir);
+}
+
+void dentry_cache::clear() {
+   era.fetch_add (1, memory_order_release);
+}
+
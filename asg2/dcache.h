@@ -0,0 +1,103 @@
+// $Id: dcache.h,v 1.1 $
+
+// dcache -
+//    Full pathname lookup cache in front of resolvePath.  Maps a
+//    starting inode and a path string to the inode the path
+//    resolved to, or to nullptr for a path that did not resolve.
+//    Each entry remembers every directory its walk looked into,
+//    along with the stamp each had then, and is good only as long
+//    as none of those stamps has moved.
+
+#ifndef __DCACHE_H__
+#define __DCACHE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "file_sys.h"
+
+// dentry_cache -
+//    static class for the lookup cache.
+// depend -
+//    Adds a directory to the list a walk depends on.  Called before
+//    the walk looks into it, so that a change the walk may not have
+//    seen leaves the entry out of date.
+// lookup -
+//    Returns true and sets result if (start, path) is cached and
+//    none of the directories it depends on has changed since.  A
+//    cached negative entry sets result to nullptr.  On a miss, sets
+//    ticket for the insert that follows the walk.
+// insert -
+//    Records the result of a walk along with the directories it
+//    depends on.  Does nothing if the cache was cleared since the
+//    lookup that handed out ticket.
+// invalidate -
+//    Called by directory whenever its dirents change, after the
+//    change is published.  Moves the stamp of the directory on, so
+//    the entries whose walk looked into it are out of date.
+// clear -
+//    Drops everything.
+//
+// Any thread may call these, and none takes a lock.  Stamps are
+// atomic counters kept by inode number, in chunks that never move
+// once allocated.  A new inode may get the number or the address of
+// one that was freed, but the inode_table moves the stamp of each
+// inode on as it frees its number, so entries that depended on the
+// old inode are never good again, however it was freed.
+// Entries are kept per thread, which checks them against the
+// stamps on each hit and drops the ones that are out of date.
+
+class dentry_cache {
+   public:
+      struct dependency {
+         int inode_nr;
+         uint64_t stamp;
+      };
+      using deplist = vector<dependency>;
+   private:
+      struct key {
+         const inode* start;
+         string path;
+         bool operator== (const key& that) const {
+            return start == that.start and path == that.path;
+         }
+      };
+      struct key_hash {
+         size_t operator() (const key& k) const {
+            return hash<string>() (k.path)
+                 ^ (hash<const inode*>() (k.start) << 1);
+         }
+      };
+      struct entry {
+         inode* result;
+         deplist deps;
+      };
+      static constexpr size_t chunk_bits = 12;
+      static constexpr size_t chunk_size = size_t (1) << chunk_bits;
+      static constexpr size_t max_chunks = size_t (1) << 19;
+      static constexpr size_t max_entries = 1 << 16;
+      static atomic<atomic<uint64_t>*> stamps[max_chunks];
+      static atomic<uint64_t> era;
+      static thread_local unordered_map<key,entry,key_hash> entries;
+      static thread_local uint64_t entries_era;
+      static thread_local key probe;
+      static key& make_probe (const inode* start, string_view path);
+      static uint64_t stamp (int inode_nr);
+   public:
+      static void depend (deplist& deps, const inode* dir);
+      static bool lookup (const inode* start, string_view path,
+                          inode*& result, uint64_t& ticket);
+      static void insert (const inode* start, string_view path,
+                          inode* result, const deplist& deps,
+                          uint64_t ticket);
+      static void invalidate (const inode* dir);
+      static void clear();
+};
+
+#endif
+
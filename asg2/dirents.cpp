@@ -0,0 +1,360 @@
+// $Id: dirents.cpp,v 1.1 $
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+using namespace std;
+
+#include "debug.h"
+#include "dirents.h"
+#include "epoch.h"
+#include "frozen.h"
+
+// Returns the position of the name in the flat vector, or its
+// size if the name is not there.  Past scan_limit entries the
+// vector is searched by name, as it is kept in name order.
+size_t dirent_table::version::flat_find (name_id name) const {
+   if (flat.size() <= scan_limit) {
+      for (size_t pos = 0; pos < flat.size(); ++pos) {
+         if (flat[pos].name == name) return pos;
+      }
+      return flat.size();
+   }
+   if (name == name_table::no_name) return flat.size();
+   size_t pos = lower_bound (flat.begin(), flat.end(), name,
+                             [] (const entry& item, name_id key) {
+                                return name_less() (item.name, key);
+                             }) - flat.begin();
+   return pos < flat.size() and flat[pos].name == name ? pos
+                                                       : flat.size();
+}
+
+// The entries are already in order, so the treap is built in one
+// pass with a stack of the nodes down its right edge.  Nothing can
+// see the nodes yet, so they are linked up in place.
+void dirent_table::version::promote() {
+   DEBUGF ('d', "promoting " << flat.size() << " entries");
+   vector<shared_ptr<tree_node>> spine;
+   for (entry& item: flat) {
+      uint32_t priority = priority_of (item.name);
+      auto node = make_shared<tree_node> (
+            tree_node {move (item), priority, {}, {}});
+      shared_ptr<tree_node> below;
+      while (not spine.empty()
+             and spine.back()->priority < node->priority) {
+         below = move (spine.back());
+         spine.pop_back();
+      }
+      node->left = move (below);
+      if (not spine.empty()) spine.back()->right = node;
+      spine.push_back (move (node));
+   }
+   tree = spine.empty() ? nullptr : move (spine.front());
+   tree_size = flat.size();
+   flat_vector().swap (flat);
+   is_tree = true;
+}
+
+inode* dirent_table::version::find (name_id name) const {
+   if (is_tree) {
+      // No_name has no string to compare, and is never an entry.
+      if (name == name_table::no_name) return nullptr;
+      const tree_node* node = tree.get();
+      while (node != nullptr and node->item.name != name) {
+         node = name_less() (name, node->item.name) ? node->left.get()
+                                                    : node->right.get();
+      }
+      return node == nullptr ? nullptr : node->item.node.get();
+   }
+   size_t pos = flat_find (name);
+   return pos == flat.size() ? nullptr : flat[pos].node.get();
+}
+
+bool dirent_table::version::flat_insert (name_id name,
+                                         const inode_ptr& node) {
+   // Appending needs just one compare.
+   if (flat.empty() or name_less() (flat.back().name, name)) {
+      flat.push_back ({name, node});
+      return true;
+   }
+   auto where = lower_bound (flat.begin(), flat.end(), name,
+                             [] (const entry& item, name_id key) {
+                                return name_less() (item.name, key);
+                             });
+   if (where != flat.end() and where->name == name) return false;
+   if (flat.size() >= flat_limit) {
+      promote();
+      return tree_insert (name, node);
+   }
+   flat.insert (where, {name, node});
+   return true;
+}
+
+// The caller has made sure the name is not there.
+bool dirent_table::version::tree_insert (name_id name,
+                                         const inode_ptr& node) {
+   tree = tree_add (tree, {name, node}, priority_of (name));
+   ++tree_size;
+   return true;
+}
+
+// Priorities come from the name id, mixed so that names interned
+// in order do not make a lopsided treap.  The mix is a bijection,
+// so no two names tie.
+uint32_t dirent_table::priority_of (name_id name) {
+   uint32_t mixed = name;
+   mixed ^= mixed >> 16;
+   mixed *= 0x85ebca6bU;
+   mixed ^= mixed >> 13;
+   mixed *= 0xc2b2ae35U;
+   mixed ^= mixed >> 16;
+   return mixed;
+}
+
+dirent_table::tree_ptr dirent_table::make_node (const entry& item,
+                       uint32_t priority, tree_ptr left, tree_ptr right) {
+   return make_shared<const tree_node> (
+          tree_node {item, priority, move (left), move (right)});
+}
+
+// Splits the tree into the entries that sort before name and those
+// that sort after it, copying only the nodes along the way down.
+void dirent_table::split (const tree_ptr& root, name_id name,
+                          tree_ptr& left, tree_ptr& right) {
+   if (root == nullptr) {
+      left = right = nullptr;
+      return;
+   }
+   tree_ptr middle;
+   if (name_less() (root->item.name, name)) {
+      split (root->right, name, middle, right);
+      left = make_node (root->item, root->priority, root->left,
+                        move (middle));
+   }else {
+      split (root->left, name, left, middle);
+      right = make_node (root->item, root->priority, move (middle),
+                         root->right);
+   }
+}
+
+// Every entry in left sorts before every entry in right.
+dirent_table::tree_ptr dirent_table::merge (const tree_ptr& left,
+                                            const tree_ptr& right) {
+   if (left == nullptr) return right;
+   if (right == nullptr) return left;
+   if (left->priority > right->priority) {
+      return make_node (left->item, left->priority, left->left,
+                        merge (left->right, right));
+   }
+   return make_node (right->item, right->priority,
+                     merge (left, right->left), right->right);
+}
+
+dirent_table::tree_ptr dirent_table::tree_add (const tree_ptr& root,
+                       const entry& item, uint32_t priority) {
+   if (root == nullptr or priority > root->priority) {
+      tree_ptr left, right;
+      split (root, item.name, left, right);
+      return make_node (item, priority, move (left), move (right));
+   }
+   if (name_less() (item.name, root->item.name)) {
+      return make_node (root->item, root->priority,
+                        tree_add (root->left, item, priority),
+                        root->right);
+   }
+   return make_node (root->item, root->priority, root->left,
+                     tree_add (root->right, item, priority));
+}
+
+// The caller has made sure the name is there.
+dirent_table::tree_ptr dirent_table::tree_remove (const tree_ptr& root,
+                       name_id name, inode_ptr& removed) {
+   if (root->item.name == name) {
+      removed = root->item.node;
+      return merge (root->left, root->right);
+   }
+   if (name_less() (name, root->item.name)) {
+      return make_node (root->item, root->priority,
+                        tree_remove (root->left, name, removed),
+                        root->right);
+   }
+   return make_node (root->item, root->priority, root->left,
+                     tree_remove (root->right, name, removed));
+}
+
+dirent_table::dirent_table(): owned (make_shared<version>()),
+              current (owned.get()) {
+   owned->born = frozen::generation();
+}
+
+// A subtree that was removed while a snapshot could see it is not
+// taken apart by destroy_tree, but kept whole by the versions held
+// for the snapshot, and is freed only when the table holding them
+// is.  Each table freed from inside another one adds its inodes to
+// the same stack, and only the outermost lets go of them, so the
+// depth of the subtree never shows up on the call stack.
+dirent_table::~dirent_table() {
+   static thread_local vector<inode_ptr> pending;
+   static thread_local bool releasing = false;
+   take_inodes (move (owned), pending);
+   for (retained& kept: history) take_inodes (move (kept.entries), pending);
+   history.clear();
+   if (releasing) return;
+   releasing = true;
+   while (not pending.empty()) {
+      inode_ptr node = move (pending.back());
+      pending.pop_back();
+   }
+   releasing = false;
+}
+
+// Tree nodes are shared by the versions of a table, so only the
+// ones that this version alone holds are gone through.  The rest
+// are gone through along with the last version that holds them.
+void dirent_table::take_inodes (shared_ptr<version> entries,
+                                vector<inode_ptr>& out) {
+   if (entries == nullptr or entries.use_count() > 1) return;
+   for (entry& item: entries->flat) out.push_back (move (item.node));
+   vector<const tree_node*> stack;
+   if (entries->tree.use_count() == 1) stack.push_back (entries->tree.get());
+   while (not stack.empty()) {
+      const tree_node* node = stack.back();
+      stack.pop_back();
+      out.push_back (node->item.node);
+      for (const tree_ptr* child: {&node->left, &node->right}) {
+         if (child->use_count() == 1) stack.push_back (child->get());
+      }
+   }
+}
+
+// Readers that loaded the old version may still be going through
+// it, so it is retired rather than dropped.  So are the inodes that
+// only it still holds.  If a snapshot was taken while it was in
+// use, it is kept for the snapshot instead, before the new version
+// is published, so that as_of never finds it in neither place.
+void dirent_table::publish (shared_ptr<version> next) {
+   next->born = frozen::generation();
+   shared_ptr<version> old = exchange (owned, move (next));
+   if (old->born < owned->born) {
+      lock_guard<mutex> guard (frozen::history_lock (this));
+      history.push_back ({owned->born, move (old)});
+   }
+   current.store (owned.get(), memory_order_release);
+   if (old != nullptr) epoch::retire (move (old));
+}
+
+// A tree is shared whole, and its nodes are copied only along the
+// path that changes.  A flat version is copied, or promoted if it
+// is too large to copy for every change.
+shared_ptr<dirent_table::version>
+dirent_table::copy_for_change() const {
+   if (owned->is_tree) {
+      auto next = make_shared<version>();
+      next->tree = owned->tree;
+      next->tree_size = owned->tree_size;
+      next->is_tree = true;
+      return next;
+   }
+   // Room is left for one more, so an insert does not copy again.
+   auto next = make_shared<version>();
+   next->flat.reserve (owned->flat.size() + 1);
+   next->flat.assign (owned->flat.begin(), owned->flat.end());
+   if (next->flat.size() >= flat_limit) next->promote();
+   return next;
+}
+
+inode* dirent_table::find (name_id name) const {
+   return current.load (memory_order_acquire)->find (name);
+}
+
+bool dirent_table::insert (name_id name, const inode_ptr& node) {
+   if (owned->find (name) != nullptr) return false;
+   shared_ptr<version> next = copy_for_change();
+   if (next->is_tree) next->tree_insert (name, node);
+                 else next->flat_insert (name, node);
+   publish (move (next));
+   return true;
+}
+
+inode_ptr dirent_table::erase (name_id name) {
+   if (owned->find (name) == nullptr) return nullptr;
+   shared_ptr<version> next = copy_for_change();
+   inode_ptr node;
+   if (next->is_tree) {
+      next->tree = tree_remove (next->tree, name, node);
+      --next->tree_size;
+   }else {
+      size_t pos = next->flat_find (name);
+      node = next->flat[pos].node;
+      next->flat.erase (next->flat.begin() + pos);
+   }
+   publish (move (next));
+   return node;
+}
+
+void dirent_table::drain (vector<inode_ptr>& out) {
+   if (owned->is_tree) {
+      const_iterator itor;
+      itor.is_tree = true;
+      itor.descend (owned->tree.get());
+      for (; not itor.path.empty(); ++itor) {
+         out.push_back (itor.path.back()->item.node);
+      }
+   }else {
+      for (const entry& item: owned->flat) out.push_back (item.node);
+   }
+   publish (make_shared<version>());
+}
+
+bool dirent_table::build (name_id name, const inode_ptr& node) {
+   if (not owned->is_tree) return owned->flat_insert (name, node);
+   if (owned->find (name) != nullptr) return false;
+   return owned->tree_insert (name, node);
+}
+
+dirent_table::view dirent_table::as_of (uint64_t generation) const {
+   static const version nothing;
+   const version* now = current.load (memory_order_acquire);
+   if (now->born <= generation) return view (now);
+   lock_guard<mutex> guard (frozen::history_lock (this));
+   auto kept = upper_bound (history.begin(), history.end(), generation,
+                            [] (uint64_t key, const retained& item) {
+                               return key < item.died;
+                            });
+   if (kept == history.end() or kept->entries->born > generation) {
+      return view (&nothing);
+   }
+   return view (kept->entries.get());
+}
+
+void dirent_table::const_iterator::descend (const tree_node* node) {
+   for (; node != nullptr; node = node->left.get()) path.push_back (node);
+}
+
+dirent_table::const_iterator& dirent_table::const_iterator::operator++() {
+   if (is_tree) {
+      const tree_node* done = path.back();
+      path.pop_back();
+      descend (done->right.get());
+   }else {
+      ++flat_itor;
+   }
+   return *this;
+}
+
+dirent_table::const_iterator dirent_table::view::begin() const {
+   const_iterator itor;
+   itor.is_tree = entries->is_tree;
+   itor.flat_itor = entries->flat.cbegin();
+   itor.descend (entries->tree.get());
+   return itor;
+}
+
+dirent_table::const_iterator dirent_table::view::end() const {
+   const_iterator itor;
+   itor.is_tree = entries->is_tree;
+   itor.flat_itor = entries->flat.cend();
+   return itor;
+}
+
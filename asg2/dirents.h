@@ -0,0 +1,198 @@
+// $Id: dirents.h,v 1.1 $
+
+// dirents -
+//    The entries of one directory, in lexicographic order of their
+//    names, in a container that changes shape with the directory.
+//
+//    The entries are published as immutable versions.  A change
+//    builds a new version beside the one in use, swaps it in with
+//    one atomic store, and retires the old one to the epoch, so
+//    readers take no lock:  a command that is pinned can look up,
+//    count and list entries while another session changes them,
+//    and sees each version whole.  Changes are still made one at a
+//    time, under the directory's lock.
+//
+//    A directory starts out flat:  a sorted vector of (name id,
+//    inode) pairs, 16 bytes each, so walking it touches a few
+//    contiguous cache lines rather than one tree node per entry.
+//    Up to scan_limit entries a lookup just scans the ids.  Past
+//    that it does a binary search by name.  Changing a flat version
+//    copies it, which is cheap while it has no more than flat_limit
+//    entries.
+//
+//    A larger directory that changes is promoted to a tree:  a
+//    treap ordered by name whose nodes are never changed once they
+//    are published.  A change copies just the path from the root
+//    to the entry and shares every other node with the old
+//    version, so it costs O(log n) however large the directory.
+//    A lookup compares names on the way down.
+//
+//    A directory built in bulk before anyone else can see it is
+//    changed in place instead, and one whose entries all go in at
+//    the end stays flat however large it gets, until it changes
+//    once it has been published.
+//
+//    A version that some snapshot may still see is kept when it is
+//    replaced, rather than retired, along with the generation that
+//    replaced it.  Versions share their tree nodes, so keeping one
+//    costs only what the change copied.
+
+#ifndef __DIRENTS_H__
+#define __DIRENTS_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+using namespace std;
+
+#include "names.h"
+
+class inode;
+using inode_ptr = shared_ptr<inode>;
+
+// dirent_table -
+// find, size, empty -
+//    Look at the version in use.  They take no lock, but the
+//    caller must be pinned to the epoch.
+// snapshot -
+//    The version in use, as a view whose iterators go through its
+//    entries in lexicographic order.  An iterator gives the name id
+//    and the inode of its entry.  The view stays as it is, however
+//    the table changes, for as long as the caller stays pinned.
+// insert -
+//    Publishes a version with the entry added and returns true, or
+//    returns false and changes nothing if the name is taken.
+// erase -
+//    Publishes a version without the entry and returns its inode,
+//    or returns nullptr if there is no such name.
+// drain -
+//    Appends every inode, in order, to out and publishes an empty
+//    version.
+// build -
+//    Like insert, but changes the version in place.  Only for a
+//    table that no other thread can reach yet.
+// as_of -
+//    The version that was in use when the snapshot of generation
+//    was taken, or an empty one if the table did not exist yet.
+//    Takes no directory lock, and the caller must be pinned to the
+//    epoch, like snapshot.
+// dtor -
+//    Lets go of the inodes that its versions held one at a time,
+//    rather than from inside the dtor of each, so that freeing a
+//    deep subtree that snapshots kept does not recurse.
+//
+// Whoever calls insert, erase or drain must hold the directory's
+// lock, so that no two changes race to publish.
+
+class dirent_table {
+   private:
+      struct entry {
+         name_id name;
+         inode_ptr node;
+      };
+      struct tree_node;
+      using tree_ptr = shared_ptr<const tree_node>;
+      struct tree_node {
+         entry item;
+         uint32_t priority;
+         tree_ptr left;
+         tree_ptr right;
+      };
+      using flat_vector = vector<entry>;
+      static constexpr size_t scan_limit = 16;
+      static constexpr size_t flat_limit = 32;
+      struct version {
+         flat_vector flat;
+         tree_ptr tree;
+         size_t tree_size {0};
+         bool is_tree {false};
+         uint64_t born {0};
+         size_t size() const {
+            return is_tree ? tree_size : flat.size();
+         }
+         inode* find (name_id name) const;
+         size_t flat_find (name_id name) const;
+         void promote();
+         bool flat_insert (name_id name, const inode_ptr& node);
+         bool tree_insert (name_id name, const inode_ptr& node);
+      };
+      static uint32_t priority_of (name_id name);
+      static tree_ptr make_node (const entry& item, uint32_t priority,
+                                 tree_ptr left, tree_ptr right);
+      static void split (const tree_ptr& root, name_id name,
+                         tree_ptr& left, tree_ptr& right);
+      static tree_ptr merge (const tree_ptr& left, const tree_ptr& right);
+      static tree_ptr tree_add (const tree_ptr& root, const entry& item,
+                                uint32_t priority);
+      static tree_ptr tree_remove (const tree_ptr& root, name_id name,
+                                   inode_ptr& removed);
+      struct retained {
+         uint64_t died;
+         shared_ptr<version> entries;
+      };
+      shared_ptr<version> owned;
+      atomic<const version*> current;
+      // Oldest first, so in order of both born and died.  Guarded
+      // by frozen::history_lock.
+      vector<retained> history;
+      void publish (shared_ptr<version> next);
+      shared_ptr<version> copy_for_change() const;
+      static void take_inodes (shared_ptr<version> entries,
+                               vector<inode_ptr>& out);
+   public:
+      class const_iterator {
+         friend class dirent_table;
+         private:
+            flat_vector::const_iterator flat_itor;
+            vector<const tree_node*> path;
+            bool is_tree {false};
+            void descend (const tree_node* node);
+         public:
+            name_id name() const {
+               return is_tree ? path.back()->item.name
+                              : flat_itor->name;
+            }
+            inode* node() const {
+               return is_tree ? path.back()->item.node.get()
+                              : flat_itor->node.get();
+            }
+            const_iterator& operator++();
+            bool operator== (const const_iterator& that) const {
+               return is_tree ? path == that.path
+                              : flat_itor == that.flat_itor;
+            }
+            bool operator!= (const const_iterator& that) const {
+               return not (*this == that);
+            }
+      };
+      class view {
+         friend class dirent_table;
+         private:
+            const version* entries;
+            explicit view (const version* entries_):
+                     entries (entries_) {}
+         public:
+            size_t size() const { return entries->size(); }
+            const_iterator begin() const;
+            const_iterator end() const;
+      };
+      dirent_table();
+      ~dirent_table();
+      dirent_table (const dirent_table&) = delete;
+      dirent_table& operator= (const dirent_table&) = delete;
+      size_t size() const { return snapshot().size(); }
+      bool empty() const { return size() == 0; }
+      inode* find (name_id name) const;
+      view snapshot() const {
+         return view (current.load (memory_order_acquire));
+      }
+      bool insert (name_id name, const inode_ptr& node);
+      inode_ptr erase (name_id name);
+      void drain (vector<inode_ptr>& out);
+      bool build (name_id name, const inode_ptr& node);
+      view as_of (uint64_t generation) const;
+};
+
+#endif
+
@@ -0,0 +1,81 @@
+// $Id: epoch.cpp,v 1.1 $
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+#include "debug.h"
+#include "epoch.h"
+
+// Zero in a reader means it is not pinned, so epochs start at one.
+atomic<uint64_t> epoch::current {1};
+atomic<size_t> epoch::waiting {0};
+mutex epoch::lock;
+vector<epoch::reader*> epoch::readers;
+deque<epoch::retired> epoch::limbo;
+
+epoch::reader::reader() {
+   lock_guard<mutex> guard (epoch::lock);
+   readers.push_back (this);
+}
+
+epoch::reader::~reader() {
+   lock_guard<mutex> guard (epoch::lock);
+   readers.erase (find (readers.begin(), readers.end(), this));
+}
+
+epoch::reader& epoch::this_reader() {
+   static thread_local reader self;
+   return self;
+}
+
+// The pin is stored before anything in the tree is read, so a
+// thread that retires something either sees the pin or unlinked
+// it before this thread could have found it.
+epoch::guard::guard() {
+   reader& self = this_reader();
+   if (self.depth++ == 0) self.pinned = current.load();
+}
+
+epoch::guard::~guard() {
+   reader& self = this_reader();
+   if (--self.depth > 0) return;
+   self.pinned.store (0, memory_order_release);
+   if (waiting > 0) reclaim();
+}
+
+// Tags are taken under the lock, so limbo stays in tag order.
+void epoch::retire (shared_ptr<void> garbage) {
+   if (garbage == nullptr) return;
+   {
+      lock_guard<mutex> guard (lock);
+      limbo.push_back ({current++, move (garbage)});
+      ++waiting;
+   }
+   reclaim();
+}
+
+// Garbage is dropped after the lock is released, since dropping it
+// may free a great deal.
+void epoch::reclaim() {
+   vector<shared_ptr<void>> freed;
+   {
+      lock_guard<mutex> guard (lock);
+      uint64_t oldest = UINT64_MAX;
+      for (const reader* each: readers) {
+         uint64_t pinned = each->pinned;
+         if (pinned != 0) oldest = min (oldest, pinned);
+      }
+      while (not limbo.empty() and limbo.front().tag < oldest) {
+         freed.push_back (move (limbo.front().garbage));
+         limbo.pop_front();
+      }
+      waiting -= freed.size();
+   }
+   if (not freed.empty()) {
+      DEBUGF ('e', "reclaimed " << freed.size() << ", "
+             << waiting << " waiting");
+   }
+}
+
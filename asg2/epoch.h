@@ -0,0 +1,74 @@
+// $Id: epoch.h,v 1.1 $
+
+// epoch -
+//    Deferred freeing of what has been taken out of the tree, for
+//    when many threads work on it at once.  A thread that looks
+//    through the tree pins the current epoch first, and a command
+//    holds on to plain pointers only while it is pinned.  Whatever
+//    is unlinked is retired rather than freed, tagged with the
+//    epoch it was retired in, and is only freed once every thread
+//    that was pinned at or before that epoch has let go.  Nothing
+//    that was reachable when a command started can disappear from
+//    under it.
+
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+// epoch -
+//    static class for the process wide epoch.
+// guard -
+//    Pins the current epoch for its lifetime.  Guards nest, and
+//    only the outermost one pins.  Letting go of the last one
+//    frees whatever can be freed by then.
+// retire -
+//    Takes ownership of garbage, which no one can reach any more
+//    except through pointers taken before it was unlinked, and
+//    drops it once no guard that could have seen it is left.
+//    Garbage retired by a thread that holds no guard, with no
+//    other thread pinned, is dropped at once.
+// reclaim -
+//    Drops everything that no pinned thread can still be using.
+// pending -
+//    The number of retired items not yet dropped.
+
+class epoch {
+   private:
+      struct reader {
+         atomic<uint64_t> pinned {0};
+         size_t depth {0};
+         reader();
+         ~reader();
+      };
+      struct retired {
+         uint64_t tag;
+         shared_ptr<void> garbage;
+      };
+      static atomic<uint64_t> current;
+      static atomic<size_t> waiting;
+      static mutex lock;
+      static vector<reader*> readers;
+      static deque<retired> limbo;
+      static reader& this_reader();
+   public:
+      class guard {
+         public:
+            guard();
+            ~guard();
+            guard (const guard&) = delete;
+            guard& operator= (const guard&) = delete;
+      };
+      static void retire (shared_ptr<void> garbage);
+      static void reclaim();
+      static size_t pending() { return waiting; }
+};
+
+#endif
+
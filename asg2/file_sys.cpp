@@ -1,15 +1,18 @@
 // $Id: file_sys.cpp,v 1.5 2016-01-14 16:16:52-08 - - $
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <unordered_map>
+#include <utility>
 
 using namespace std;
 
+#include "dcache.h"
 #include "debug.h"
+#include "epoch.h"
 #include "file_sys.h"
-
-int inode::next_inode_nr {1};
+#include "inodes.h"
 
 struct file_type_hash {
    size_t operator() (file_type type) const {
@@ -28,27 +31,74 @@ ostream& operator<< (ostream& out, file_type type) {
 inode_state::inode_state() {
    DEBUGF ('i', "root = " << root << ", cwd = " << cwd
           << ", prompt = \"" << prompt() << "\"");
-   inode_ptr newNode = make_shared<inode>(file_type::DIRECTORY_TYPE);
+   inode_ptr newNode = inode::make (file_type::DIRECTORY_TYPE, arena);
    root = newNode;
    cwd = root;
 }
 
+inode_state::inode_state (inode_state& tree): owns_tree (false),
+             root (tree.root) {
+   setCwd (root->getContents()->getNode ("/"));
+}
+
+// Nothing may still point into the arena once it releases its
+// slabs, so empty every directory first.  Taking the tree apart
+// level by level rather than letting the dtors recurse keeps deep
+// trees from overflowing the stack.
+inode_state::~inode_state() {
+   if (not owns_tree) {
+      epoch::retire (move (cwd));
+      return;
+   }
+   dentry_cache::clear();
+   destroy_tree (move (root));
+   cwd = nullptr;
+   epoch::reclaim();
+}
+
+void destroy_tree (inode_ptr root) {
+   auto garbage = make_shared<vector<inode_ptr>>();
+   vector<inode_ptr> stack;
+   stack.push_back (move (root));
+   while (not stack.empty()) {
+      garbage->push_back (move (stack.back()));
+      stack.pop_back();
+      garbage->back()->getContents()->dismantle (stack);
+   }
+   epoch::retire (move (garbage));
+}
+
 const string& inode_state::prompt() { return prompt_; }
 
 void inode_state::setPrompt(string p) { prompt_ = p; }
 
-inode_ptr inode_state::getCwd(){
-  return cwd;
+void inode_state::setOutput (ostream& out_, ostream& err_) {
+   out = &out_;
+   err = &err_;
+}
+
+inode* inode_state::getCwd(){
+  return cwd.get();
+}
+
+// A removed directory may be kept alive by nothing but the cwd,
+// while another session still looks at it through the parent link
+// of its own cwd, so the old cwd is retired rather than dropped.
+void inode_state::setCwd(inode* node){
+  epoch::retire (exchange (cwd, node->shared_from_this()));
+  getCwdPath();
 }
 
-void inode_state::setCwd(inode_ptr node){
-  cwd = node;
+const string& inode_state::getCwdPath(){
+  string path = cwd->getFullPath();
+  if (not path.empty()) cwd_path = move (path);
+  return cwd_path;
 }
 
 // TODO double check to make sure this does not
 // violate encapsulation rules
-inode_ptr inode_state::getRoot(){
-  return root;
+inode* inode_state::getRoot(){
+  return root.get();
 }
 
 ostream& operator<< (ostream& out, const inode_state& state) {
@@ -57,18 +107,35 @@ ostream& operator<< (ostream& out, const inode_state& state) {
    return out;
 }
 
-inode::inode(file_type type): inode_nr (next_inode_nr++) {
+inode::inode(file_type type, node_arena& arena) {
    switch (type) {
       case file_type::PLAIN_TYPE:
-           contents = make_shared<plain_file>();
+           contents = allocate_shared<plain_file> (
+                      arena_allocator<plain_file> (arena));
            isDir = false;
            break;
       case file_type::DIRECTORY_TYPE:
-           contents = make_shared<directory>();
+           contents = allocate_shared<directory> (
+                      arena_allocator<directory> (arena), arena);
            isDir = true;
            break;
    }
-   DEBUGF ('i', "inode " << inode_nr << ", type = " << type);
+   contents->self = this;
+   total = contents->size();
+}
+
+inode::~inode() {
+   if (inode_nr != 0) inode_table::remove (inode_nr);
+}
+
+// The inode goes into the table only once its shared_ptr owns it,
+// so that whoever finds it there can take a share.
+inode_ptr inode::make (file_type type, node_arena& arena) {
+   inode_ptr node = allocate_shared<inode> (arena_allocator<inode> (arena),
+                                            type, arena);
+   inode_table::add (node.get());
+   DEBUGF ('i', "inode " << node->inode_nr << ", type = " << type);
+   return node;
 }
 
 int inode::get_inode_nr() const {
@@ -76,8 +143,40 @@ int inode::get_inode_nr() const {
    return inode_nr;
 }
 
-base_file_ptr inode::getContents(){
-  return contents;
+base_file* inode::getContents(){
+  return contents.get();
+}
+
+const string& inode::getName() const {
+   static const string no_name;
+   return name == name_table::no_name ? no_name
+                                      : name_table::name (name);
+}
+
+string inode::getFullPath() const {
+   vector<const inode*> chain;
+   const inode* node = this;
+   // Each link is read once, since another session may be
+   // clearing it.
+   for (const inode* up = node->parent; up != nullptr; up = up->parent) {
+      chain.push_back (node);
+      node = up;
+   }
+   // Only the hidden root above / has no name.  Anything else at
+   // the top of the chain has been removed from the tree.
+   if (node->name != name_table::no_name or chain.empty()) return "";
+   string path;
+   for (auto itor = chain.rbegin() + 1; itor != chain.rend(); ++itor) {
+      path += '/';
+      path += name_table::name ((*itor)->name);
+   }
+   return path.empty() ? "/" : path;
+}
+
+void inode::addTotal (ptrdiff_t delta) {
+   for (inode* node = this; node != nullptr; node = node->parent) {
+      node->total.fetch_add (delta, memory_order_relaxed);
+   }
 }
 
 file_error::file_error (const string& what):
@@ -85,38 +184,99 @@ file_error::file_error (const string& what):
 }
 
 size_t plain_file::size() const {
-   size_t size {0};
+   size_t size = bytes;
    DEBUGF ('i', "size = " << size);
    return size;
 }
 
-const wordvec& plain_file::readfile() const {
-   DEBUGF ('i', data);
-   return data;
+file_data::file_data (string_view text): text_ (text) {
+   if (text_.empty()) return;
+   starts.push_back (0);
+   for (size_t space = text_.find (' '); space != string::npos;
+        space = text_.find (' ', space + 1)) {
+      starts.push_back (static_cast<uint32_t> (space + 1));
+   }
+}
+
+string_view file_data::word (size_t index) const {
+   size_t start = starts.at (index);
+   size_t end = index + 1 < starts.size() ? starts[index + 1] - 1
+                                           : text_.size();
+   return string_view (text_).substr (start, end - start);
 }
 
-void plain_file::writefile (const wordvec& words) {
-   DEBUGF ('i', words);
-   data = words;
+ostream& operator<< (ostream& out, const file_data& data) {
+   return out.write (data.text().data(), data.text().size());
+}
+
+const file_data& plain_file::readfile() const {
+   static const file_data empty;
+   const file_data& contents = data == nullptr ? empty : *data;
+   DEBUGF ('i', contents);
+   return contents;
+}
+
+// Each word is printed with one separator after it.
+static size_t printed_size (const blob_ptr& blob) {
+   return blob == nullptr ? 0 : blob->text().size() + 1;
+}
+
+// Sets the data and the cached size, but leaves the totals to the
+// caller.
+void plain_file::setData (blob_ptr blob) {
+   data = move (blob);
+   bytes = printed_size (data);
+}
+
+void plain_file::writefile (file_data&& newdata) {
+   DEBUGF ('i', newdata);
+   if (read_only) throw file_error ("read-only file system");
+   blob_ptr blob = blob_store::intern (move (newdata));
+   uint64_t now = frozen::generation();
+   size_t oldbytes = bytes;
+   {
+      lock_guard<mutex> guard (frozen::history_lock (this));
+      if (born < now) history.push_back ({born, now, move (data)});
+      born = now;
+      // The old blob is let go of after the lock, not under it.
+      data.swap (blob);
+   }
+   bytes = printed_size (data);
+   self->addTotal (static_cast<ptrdiff_t> (bytes - oldbytes));
+}
+
+blob_ptr plain_file::dataAsOf (uint64_t generation) const {
+   lock_guard<mutex> guard (frozen::history_lock (this));
+   if (born <= generation) return data;
+   auto kept = upper_bound (history.begin(), history.end(), generation,
+                            [] (uint64_t key, const retained& item) {
+                               return key < item.died;
+                            });
+   return kept == history.end() or kept->born > generation ? nullptr
+                                                           : kept->data;
 }
 
 void plain_file::remove (const string&) {
    throw file_error ("is a plain file");
 }
 
-inode_ptr plain_file::mkdir (const string&) {
+void plain_file::rmtree (const string&) {
+   throw file_error ("is a plain file");
+}
+
+inode* plain_file::mkdir (const string&) {
    throw file_error ("is a plain file");
 }
 
-inode_ptr plain_file::mkfile (const string&) {
+inode* plain_file::mkfile (const string&) {
    throw file_error ("is a plain file");
 }
 
-void plain_file::setPath(const string&, inode_ptr){
+void plain_file::setPath(const string&, inode*){
    throw file_error ("is a plain file");
 }
 
-string plain_file::getPath(inode_ptr){
+string plain_file::getPath(inode*){
    throw file_error ("is a plain file");
 }
 
@@ -128,33 +288,48 @@ wordvec plain_file::getAllDirs(){
   throw file_error ("is a plain file");
 }
 
-inode_ptr plain_file::getNode(const string&){
+void plain_file::getSubdirs (vector<inode*>&){
   throw file_error ("is a plain file");
 }
 
-void plain_file::printMap(){
+inode* plain_file::getNode(const string&){
+  throw file_error ("is a plain file");
+}
+
+inode* plain_file::getNode(name_id){
   throw file_error ("is a plain file");
 }
 
-string plain_file::getPwd(){
+void plain_file::printMap(){
   throw file_error ("is a plain file");
 }
 
-void plain_file::setPwd(string){
+void plain_file::printNames (ostream&){
   throw file_error ("is a plain file");
 }
 
+void plain_file::dismantle (vector<inode_ptr>&) {
+}
+
+shared_mutex& plain_file::getLock() {
+   throw file_error ("is a plain file");
+}
+
+inode* plain_file::mount (const string&, inode*, uint64_t) {
+   throw file_error ("is a plain file");
+}
+
 size_t directory::size() const {
-   size_t size {0};
+   size_t size = entries().size() + 2;
    DEBUGF ('i', "size = " << size);
    return size;
 }
 
-const wordvec& directory::readfile() const {
+const file_data& directory::readfile() const {
    throw file_error ("is a directory");
 }
 
-void directory::writefile (const wordvec&) {
+void directory::writefile (file_data&&) {
    throw file_error ("is a directory");
 }
 
@@ -166,73 +341,326 @@ void directory::writefile (const wordvec&) {
 // will be handled by fn_rmr()
 void directory::remove (const string& filename) {
    DEBUGF ('i', filename);
-   dirents.erase(filename);
+   epoch::retire (detach (filename));
 }
 
-inode_ptr directory::mkdir (const string& dirname) {
+void directory::rmtree (const string& filename) {
+   DEBUGF ('i', filename);
+   inode_ptr node = detach (filename);
+   if (node != nullptr) destroy_tree (move (node));
+}
+
+// Unlinks a dirent and hands back ownership of its node.
+inode_ptr directory::detach (const string& name) {
+   if (isReadOnly()) throw file_error ("read-only file system");
+   inode_ptr node = dirents.erase (name_table::find (name));
+   if (node == nullptr) return nullptr;
+   dentry_cache::invalidate (self);
+   self->addTotal (-1 - static_cast<ptrdiff_t> (node->total));
+   node->parent = nullptr;
+   if (node->isDirectory()) {
+      // The node may outlive its dirent as someone's cwd.
+      static_cast<directory*> (node->getContents())->removed = true;
+      node->getContents()->setPath ("..", nullptr);
+      dentry_cache::invalidate (node.get());
+   }
+   return node;
+}
+
+// Adds a dirent unless one with that name already exists.  Nothing
+// may be linked under a directory once it has been removed, since
+// it is retired and no link may lead to it after that.  The node
+// gets its name and parent before it is published, since readers
+// may come to it as soon as it is.
+void directory::insert (const string& name, inode_ptr node) {
+   if (isReadOnly()) throw file_error ("read-only file system");
+   if (removed) throw file_error ("no such file or directory");
+   name_id id = name_table::intern (name);
+   if (dirents.find (id) != nullptr) return;
+   node->parent = self;
+   node->name = id;
+   dirents.insert (id, node);
+   self->addTotal (1 + static_cast<ptrdiff_t> (node->total));
+   dentry_cache::invalidate (self);
+}
+
+inode* directory::mkdir (const string& dirname) {
    DEBUGF ('i', dirname);
-   inode_ptr newDir = make_shared<inode>(file_type::DIRECTORY_TYPE);
-   dirents.insert(pair<string,inode_ptr>(dirname, newDir));
-   newDir->getContents()->setPwd(fullPath + "/" + dirname);
-   return newDir;
+   inode_ptr newDir = inode::make (file_type::DIRECTORY_TYPE, *arena);
+   newDir->getContents()->setPath ("..", self);
+   insert (dirname, newDir);
+   return newDir.get();
 }
 
-inode_ptr directory::mkfile (const string& filename) {
+inode* directory::mkfile (const string& filename) {
    DEBUGF ('i', filename);
-   inode_ptr newFile = make_shared<inode>(file_type::PLAIN_TYPE);
-   dirents.insert(pair<string,inode_ptr>(filename, newFile));
-   return newFile;
-}
-
-void directory::setPath(const string& name, inode_ptr node){
-  dirents.insert(pair<string,inode_ptr>(name,node));
-}
-
-string directory::getPath(inode_ptr node){
-  for (auto iter = dirents.begin(); iter != dirents.end(); ++iter){
-    if (iter->second == node){
-      return iter->first;
+   inode_ptr newFile = inode::make (file_type::PLAIN_TYPE, *arena);
+   insert (filename, newFile);
+   return newFile.get();
+}
+
+void directory::setPath(const string& name, inode* node){
+  if (name == ".") self = node;
+  else if (name == "..") parent = node;
+  else insert (name, node->shared_from_this());
+  if (name == "." or name == "..") dentry_cache::invalidate (self);
+}
+
+string directory::getPath(inode* node){
+  if (node == self) return ".";
+  if (node == parent) return "..";
+  if (node != nullptr and node->parent == self) return node->getName();
+  throw file_error ("not in this directory");
+}
+
+// Dot and dotdot are merged into the names where they fall in
+// lexicographic order.
+template <typename visitor>
+void directory::forEachName (visitor visit) const {
+  static const string dots[] {".", ".."};
+  size_t next_dot = 0;
+  auto shown = entries();
+  for (auto iter = shown.begin(); iter != shown.end(); ++iter){
+    const string& name = name_table::name (iter.name());
+    while (next_dot < 2 and dots[next_dot] < name) {
+      visit (dots[next_dot++]);
     }
+    visit (name);
   }
-  return nullptr;
+  while (next_dot < 2) visit (dots[next_dot++]);
 }
 
 wordvec directory::getAllPaths(){
   wordvec pathList;
-  for (auto iter = dirents.begin(); iter != dirents.end(); ++iter){
-    pathList.push_back(iter->first);
-  }
+  pathList.reserve (size());
+  forEachName ([&pathList] (const string& name) {
+    pathList.push_back (name);
+  });
   return pathList;
 }
 
+void directory::printNames (ostream& out){
+  forEachName ([&out] (const string& name) {
+    out << name << '\n';
+  });
+}
+
 wordvec directory::getAllDirs(){
   wordvec dirList;
-  for (auto iter = dirents.begin(); iter != dirents.end(); ++iter){
-    if ((iter->second->isDirectory()) && (iter->first != ".") && (iter->first != ".."))
-      dirList.push_back(iter->first);
+  auto shown = entries();
+  for (auto iter = shown.begin(); iter != shown.end(); ++iter){
+    if (iter.node()->isDirectory())
+      dirList.push_back(name_table::name (iter.name()));
   }
   return dirList;
 }
 
-inode_ptr directory::getNode(const string& path){
-   auto it = dirents.find(path);
-   if (it == dirents.end())
-      return nullptr;
-   return dirents.find(path)->second;
+void directory::getSubdirs (vector<inode*>& dirs){
+  auto shown = entries();
+  for (auto iter = shown.begin(); iter != shown.end(); ++iter){
+    if (iter.node()->isDirectory()) dirs.push_back (iter.node());
+  }
+}
+
+inode* directory::getNode(const string& path){
+   return getNode (name_table::find (path));
+}
+
+inode* directory::getNode(name_id name){
+   if (name == name_table::dot) return self;
+   if (name == name_table::dotdot) return parent;
+   fill();
+   return dirents.find (name);
 }
 
 void directory::printMap(){
   cout << "Map contents:" << endl;
-  for (auto it = dirents.begin(); it != dirents.end(); ++it){
-    cout << it->first << " -> " << it->second << endl;
+  cout << ". -> " << self << endl << ".. -> " << parent << endl;
+  auto shown = entries();
+  for (auto it = shown.begin(); it != shown.end(); ++it){
+    cout << name_table::name (it.name()) << " -> " << it.node()
+         << endl;
   }
   cout << endl;
 }
 
-string directory::getPwd(){
-  return fullPath;
+// A mounted snapshot that was never filled is left empty:  taking
+// its flag with nothing to do keeps anyone from filling it later,
+// and waits out anyone who is filling it now, so that it is not
+// copied in whole just to be freed.  The cache is told once it is
+// empty, so no walk can cache a child that is about to be freed.
+void directory::dismantle (vector<inode_ptr>& orphans){
+  call_once (filled, [] {});
+  write_lock guard (lock);
+  removed = true;
+  auto entries = dirents.snapshot();
+  for (auto it = entries.begin(); it != entries.end(); ++it){
+    if (it.node()->isDirectory()) {
+      it.node()->getContents()->setPath ("..", nullptr);
+    }
+    it.node()->parent = nullptr;
+  }
+  dirents.drain (orphans);
+  dentry_cache::invalidate (self);
+}
+
+inode* directory::mount (const string& name, inode* source,
+                         uint64_t generation) {
+   DEBUGF ('i', name << " = snapshot " << generation);
+   inode_ptr mounted = inode::make (file_type::DIRECTORY_TYPE, *arena);
+   directory* contents = static_cast<directory*> (mounted->getContents());
+   contents->source = source;
+   contents->as_of = generation;
+   contents->parent = self;
+   insert (name, mounted);
+   return mounted.get();
+}
+
+// A mounted snapshot is filled the first time anything looks into
+// it, with a read-only copy of each dirent its source had then:
+// a directory that fills itself in turn, or a plain file with the
+// contents it had.  Filling does not change what the directory
+// shows, so it may be done from const members, and every other
+// reader waits for it in call_once, so the dirents are built in
+// place.  The caller may hold any directory's lock, so the source is
+// read without its own, through what it keeps for the snapshot.
+void directory::fill() const {
+   if (source == nullptr) return;
+   call_once (filled, [this] {
+      directory* self_ = const_cast<directory*> (this);
+      directory* from = static_cast<directory*> (source->getContents());
+      auto then = from->dirents.as_of (as_of);
+      for (auto itor = then.begin(); itor != then.end(); ++itor) {
+         inode* node = itor.node();
+         inode_ptr copy;
+         if (node->isDirectory()) {
+            if (node->getContents()->isReadOnly()) continue;
+            copy = inode::make (file_type::DIRECTORY_TYPE, *arena);
+            directory* dir = static_cast<directory*> (copy->getContents());
+            dir->source = node;
+            dir->as_of = as_of;
+            dir->parent = self;
+         }else {
+            copy = inode::make (file_type::PLAIN_TYPE, *arena);
+            plain_file* file = static_cast<plain_file*> (copy->getContents());
+            const plain_file* was =
+                  static_cast<const plain_file*> (node->getContents());
+            file->setData (was->dataAsOf (as_of));
+            file->read_only = true;
+            copy->total = file->bytes;
+         }
+         copy->parent = self;
+         copy->name = itor.name();
+         self_->dirents.build (itor.name(), copy);
+      }
+      DEBUGF ('i', "filled " << dirents.size() << " from snapshot "
+              << as_of);
+   });
+}
+
+dirent_table::view directory::entries() const {
+   fill();
+   return dirents.snapshot();
+}
+
+tree_walker::tree_walker (inode* start_): start (start_),
+             path_ (start_->getFullPath()) {
+}
+
+void tree_walker::push (inode* dir) {
+   directory* contents = static_cast<directory*> (dir->getContents());
+   auto entries = contents->entries();
+   stack.push_back ({entries.begin(), entries.end(), path_.size()});
+}
+
+inode* tree_walker::next() {
+   if (start != nullptr) {
+      inode* first = start;
+      start = nullptr;
+      push (first);
+      return first;
+   }
+   while (not stack.empty()) {
+      frame& top = stack.back();
+      while (top.next != top.end and not top.next.node()->isDirectory()) {
+         ++top.next;
+      }
+      if (top.next == top.end) {
+         stack.pop_back();
+         continue;
+      }
+      inode* child = top.next.node();
+      ++top.next;
+      path_.resize (top.length);
+      if (path_ != "/") path_ += '/';
+      path_ += child->getName();
+      push (child);
+      return child;
+   }
+   return nullptr;
+}
+
+inode* tree_builder::add (inode* dir, string_view name, file_type type,
+                          file_data&& data) {
+   directory* contents = static_cast<directory*> (dir->getContents());
+   name_id id = name_table::intern (name);
+   inode_ptr node = inode::make (type, *contents->arena);
+   node->name = id;
+   if (contents->building) {
+      if (not contents->dirents.build (id, node)) return nullptr;
+      node->parent = dir;
+      if (type == file_type::DIRECTORY_TYPE) {
+         static_cast<directory*> (node->getContents())->parent = dir;
+      }
+   }else {
+      if (contents->dirents.find (id) != nullptr) return nullptr;
+      tops.push_back ({dir, node});
+   }
+   if (type == file_type::DIRECTORY_TYPE) {
+      static_cast<directory*> (node->getContents())->building = true;
+   }
+   if (type == file_type::PLAIN_TYPE and not data.text().empty()) {
+      plain_file* file = static_cast<plain_file*> (node->getContents());
+      file->setData (blob_store::intern (move (data)));
+      node->total = file->bytes;
+   }
+   added.push_back (node.get());
+   return node.get();
+}
+
+// Children were added after their parents, so going backwards
+// finishes each new subtree before its total is passed up.  The
+// tops of the new subtrees have no parent until they are linked.
+void tree_builder::finish() {
+   for (auto itor = added.rbegin(); itor != added.rend(); ++itor) {
+      inode* parent = (*itor)->parent;
+      if (parent != nullptr) parent->total += 1 + (*itor)->total;
+      if ((*itor)->isDirectory()) {
+         static_cast<directory*> ((*itor)->getContents())->building = false;
+      }
+   }
+   added.clear();
+   for (auto& [dir, node]: tops) {
+      directory* contents = static_cast<directory*> (dir->getContents());
+      {
+         write_lock guard (contents->lock);
+         node->parent = dir;
+         if (node->isDirectory()) {
+            static_cast<directory*> (node->getContents())->parent = dir;
+         }
+         if (not contents->removed
+         and contents->dirents.insert (node->name, node)) {
+            dir->addTotal (1 + static_cast<ptrdiff_t> (node->total));
+            dentry_cache::invalidate (dir);
+            continue;
+         }
+      }
+      dropped.push_back (node.get());
+      destroy_tree (move (node));
+   }
+   tops.clear();
 }
 
-void directory::setPwd(string newPwd){
-  fullPath = newPwd;
-}
\ No newline at end of file
+bool tree_builder::was_dropped (const inode* node) const {
+   return find (dropped.begin(), dropped.end(), node) != dropped.end();
+}
@@ -3,13 +3,23 @@
 #ifndef __INODE_H__
 #define __INODE_H__
 
+#include <atomic>
 #include <exception>
 #include <iostream>
+#include <cstdint>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
+#include "blobs.h"
+#include "dirents.h"
+#include "frozen.h"
+#include "names.h"
+#include "slab.h"
 #include "util.h"
 
 // inode_t -
@@ -22,12 +32,30 @@ class plain_file;
 class directory;
 using inode_ptr = shared_ptr<inode>;
 using base_file_ptr = shared_ptr<base_file>;
+using read_lock = shared_lock<shared_mutex>;
+using write_lock = unique_lock<shared_mutex>;
 ostream& operator<< (ostream&, file_type);
 
 // inode_state -
 //    A small convenient class to maintain the state of the simulated
-//    process:  the root (/), the current directory (.), and the
-//    prompt.
+//    process:  the root (/), the current directory (.), the prompt,
+//    and where output and error messages go.  It also owns the
+//    arena every inode in the tree is allocated from.  The dtor
+//    takes the tree apart before the arena releases its slabs.
+// ctor (inode_state&) -
+//    A server session:  shares the tree of the state given, and
+//    starts in / with its own prompt.  Its dtor leaves the tree
+//    alone.
+// output, errors, setOutput -
+//    The streams commands write to:  cout and cerr, unless a
+//    server session points them at its connection.
+// getCwd, setCwd, getRoot -
+//    Hand out plain pointers.  The state keeps the cwd alive with
+//    its own shared_ptr, taken from the node when it is set.
+// getCwdPath -
+//    The absolute path of the cwd, from its parent links.  If the
+//    cwd has been removed, the path it last had, as a shell's $PWD
+//    would still show it.
 
 class inode_state {
    friend class inode;
@@ -35,49 +63,173 @@ class inode_state {
    private:
       inode_state (const inode_state&) = delete; // copy ctor
       inode_state& operator= (const inode_state&) = delete; // op=
+      node_arena arena;
+      bool owns_tree {true};
       inode_ptr root {nullptr};
       inode_ptr cwd {nullptr};
+      string cwd_path;
       string prompt_ {"% "};
+      ostream* out {&cout};
+      ostream* err {&cerr};
    public:
       inode_state();
+      explicit inode_state (inode_state& tree);
+      ~inode_state();
       const string& prompt();
       void setPrompt(string p);
-      inode_ptr getCwd();
-      void setCwd(inode_ptr node);
-      inode_ptr getRoot();
+      ostream& output() { return *out; }
+      ostream& errors() { return *err; }
+      void setOutput (ostream& out_, ostream& err_);
+      inode* getCwd();
+      void setCwd(inode* node);
+      const string& getCwdPath();
+      inode* getRoot();
 };
 
 // class inode -
 // inode ctor -
-//    Create a new inode of the given type.
+//    Create a new inode of the given type.  Its contents come from
+//    the arena, which directories also use for their children.
+// make -
+//    Allocates an inode and its shared_ptr control block together
+//    from the arena, and enters it in the inode_table.
+// dtor -
+//    Takes the inode out of the inode_table, freeing its number.
 // get_inode_nr -
-//    Retrieves the serial number of the inode.  Inode numbers are
-//    allocated in sequence by small integer.
+//    Retrieves the number of the inode, a small integer.  Numbers
+//    of freed inodes are handed out again, so the inode_table
+//    stays dense.
+// getContents -
+//    Returns a plain pointer to the contents, which the inode owns.
+//
+// Ownership of the tree runs strictly downward:  a directory owns
+// its children through its dirents, and nothing else in the tree
+// holds a shared_ptr.  Dot and dotdot are plain pointers kept by
+// the directory, so removing a subtree frees it, and walking the
+// tree touches no reference counts.
 // size -
 //    Returns the size of an inode.  For a directory, this is the
 //    number of dirents.  For a text file, the number of characters
 //    when printed (the sum of the lengths of each word, plus the
 //    number of words.
+// getTotal -
+//    The size of the inode plus the sizes of everything under it,
+//    as du would count it.  Kept up to date as the tree changes,
+//    so reading it is O(1).
+// addTotal -
+//    Adds delta to the total of this inode and of each directory
+//    that contains it, up to the root.  Totals are atomic, since
+//    changes to different directories share their ancestors.
+// getParent -
+//    The directory whose dirent owns this inode, or nullptr for
+//    the root and for a detached inode.
+// getName -
+//    The name of the dirent that owns this inode, or the name it
+//    had when it was removed.  Empty for the hidden root.
+// getFullPath -
+//    The absolute path of the inode, as pwd prints it, built from
+//    the parent links in O(depth).  Empty if the inode is no longer
+//    in the tree.
 //
 
-class inode {
+class inode: public enable_shared_from_this<inode> {
    friend class inode_state;
+   friend class directory;
+   friend class inode_table;
+   friend class tree_builder;
    private:
       bool isDir;
-      static int next_inode_nr;
-      int inode_nr;
+      int inode_nr {0};
       base_file_ptr contents;
+      atomic<inode*> parent {nullptr};
+      name_id name {name_table::no_name};
+      atomic<size_t> total {0};
    public:
       bool isDirectory() { return isDir; }
-      inode (file_type);
+      inode (file_type, node_arena&);
+      inode (const inode&) = delete;
+      inode& operator= (const inode&) = delete;
+      ~inode();
+      static inode_ptr make (file_type, node_arena&);
       int get_inode_nr() const;
-      base_file_ptr getContents();
+      base_file* getContents();
+      inode* getParent() { return parent; }
+      const string& getName() const;
+      string getFullPath() const;
+      size_t getTotal() const { return total; }
+      void addTotal (ptrdiff_t delta);
 };
 
+// destroy_tree -
+//    Takes a detached subtree apart one node at a time off an
+//    explicit stack, so no dtor ever recurses into its children,
+//    and retires the nodes to the epoch, which frees them once no
+//    command can still be looking at them.  Each directory is
+//    locked while it is emptied.
+
+void destroy_tree (inode_ptr root);
+
+// file_data -
+//    The contents of a plain file:  the words stored back to back in
+//    one buffer, separated by single spaces, with the offset where
+//    each word starts.  Building one from a range of words makes a
+//    single allocation for the text, and printing it is a single
+//    write of the buffer.
+// ctor -
+//    Takes any range of things that convert to string_view, or the
+//    text of a file as it is printed, which is split at its spaces.
+// word_count, word -
+//    The number of words and a view of one of them.
+// text -
+//    The words as they are printed, separated by spaces.
+
+class file_data {
+   private:
+      string text_;
+      vector<uint32_t> starts;
+   public:
+      file_data() = default;
+      explicit file_data (string_view text);
+      template <typename iterator>
+      file_data (iterator begin, iterator end);
+      size_t word_count() const { return starts.size(); }
+      string_view word (size_t index) const;
+      const string& text() const { return text_; }
+};
+
+ostream& operator<< (ostream&, const file_data&);
+
+template <typename iterator>
+file_data::file_data (iterator begin, iterator end) {
+   size_t length = 0;
+   size_t count = 0;
+   for (auto itor = begin; itor != end; ++itor, ++count) {
+      length += string_view (*itor).size() + 1;
+   }
+   if (count == 0) return;
+   text_.reserve (length - 1);
+   starts.reserve (count);
+   for (auto itor = begin; itor != end; ++itor) {
+      if (not text_.empty()) text_ += ' ';
+      starts.push_back (static_cast<uint32_t> (text_.size()));
+      text_ += string_view (*itor);
+   }
+}
+
 // class base_file -
 // Just a base class at which an inode can point.  No data or
 // functions.  Makes the synthesized members useable only from
 // the derived classes.
+// getLock -
+//    The reader-writer lock of a directory.  Whoever changes its
+//    dirents holds it exclusive.  Whoever reads the contents of a
+//    plain file in it holds it shared, and whoever changes them
+//    holds it exclusive.  Looking up and listing dirents takes no
+//    lock, only a pin on the epoch, since the dirents are published
+//    as versions that never change.  The members of directory and
+//    plain_file leave locking to the caller, except where they say
+//    otherwise.  When more than one is held, a directory is always
+//    locked before anything under it.
 
 class file_error: public runtime_error {
    public:
@@ -85,7 +237,9 @@ class file_error: public runtime_error {
 };
 
 class base_file {
+   friend class inode;
    protected:
+      inode* self {nullptr};
       base_file() = default;
       base_file (const base_file&) = delete;
       base_file (base_file&&) = delete;
@@ -94,88 +248,276 @@ class base_file {
    public:
       virtual ~base_file() = default;
       virtual size_t size() const = 0;
-      virtual const wordvec& readfile() const = 0;
-      virtual void writefile (const wordvec& newdata) = 0;
+      virtual const file_data& readfile() const = 0;
+      virtual void writefile (file_data&& newdata) = 0;
       virtual void remove (const string& filename) = 0;
-      virtual inode_ptr mkdir (const string& dirname) = 0;
-      virtual inode_ptr mkfile (const string& filename) = 0;
-      virtual void setPath(const string& name, inode_ptr node) = 0;
-      virtual string getPath(inode_ptr node) = 0;
+      virtual void rmtree (const string& filename) = 0;
+      virtual inode* mkdir (const string& dirname) = 0;
+      virtual inode* mkfile (const string& filename) = 0;
+      virtual void setPath(const string& name, inode* node) = 0;
+      virtual string getPath(inode* node) = 0;
       virtual wordvec getAllPaths() = 0;
       virtual wordvec getAllDirs() = 0;
-      virtual inode_ptr getNode(const string& path) = 0;
+      virtual void getSubdirs (vector<inode*>& dirs) = 0;
+      virtual inode* getNode(const string& path) = 0;
+      virtual inode* getNode(name_id name) = 0;
       virtual void printMap() = 0;
-      virtual string getPwd() = 0;
-      virtual void setPwd(string newPwd) = 0;
+      virtual void printNames (ostream& out) = 0;
+      virtual void dismantle (vector<inode_ptr>& orphans) = 0;
+      virtual shared_mutex& getLock() = 0;
+      virtual inode* mount (const string& name, inode* source,
+                            uint64_t generation) = 0;
+      virtual bool isReadOnly() const = 0;
 };
 
 // class plain_file -
 // Used to hold data.
 // synthesized default ctor -
-//    Default vector<string> is a an empty vector.
+//    Default file_data is empty.
 // readfile -
-//    Returns a copy of the contents of the wordvec in the file.
+//    Returns the contents of the file, which are shared with every
+//    other file that has the same text.
 // writefile -
-//    Replaces the contents of a file with new contents.
+//    Points the file at the blob of the new contents, and updates
+//    the cached size and the totals above the file.  If a snapshot
+//    was taken since the old contents were written, they are kept
+//    for it.  Throws file_error if the file is in a mounted
+//    snapshot.
+// isReadOnly -
+//    Whether the file is in a mounted snapshot.
 
 class plain_file: public base_file {
+   friend class directory;
+   friend class tree_builder;
    private:
-      wordvec data;
+      struct retained {
+         uint64_t born;
+         uint64_t died;
+         blob_ptr data;
+      };
+      // Nullptr while the file is empty.
+      blob_ptr data;
+      size_t bytes {0};
+      uint64_t born {frozen::generation()};
+      vector<retained> history;
+      bool read_only {false};
+      void setData (blob_ptr blob);
+      // What the file held in the snapshot of generation.  Takes
+      // only frozen::history_lock, which writefile also holds to
+      // change the data.
+      blob_ptr dataAsOf (uint64_t generation) const;
    public:
       virtual size_t size() const override;
-      virtual const wordvec& readfile() const override;
-      virtual void writefile (const wordvec& newdata) override;
+      virtual const file_data& readfile() const override;
+      virtual void writefile (file_data&& newdata) override;
       virtual void remove (const string& filename) override;
-      virtual inode_ptr mkdir (const string& dirname) override;
-      virtual inode_ptr mkfile (const string& filename) override;
-      virtual void setPath(const string& name, inode_ptr node) override;
-      virtual string getPath(inode_ptr node) override;
+      virtual void rmtree (const string& filename) override;
+      virtual inode* mkdir (const string& dirname) override;
+      virtual inode* mkfile (const string& filename) override;
+      virtual void setPath(const string& name, inode* node) override;
+      virtual string getPath(inode* node) override;
       virtual wordvec getAllPaths() override;
       virtual wordvec getAllDirs() override;
-      virtual inode_ptr getNode(const string& path) override;
+      virtual void getSubdirs (vector<inode*>& dirs) override;
+      virtual inode* getNode(const string& path) override;
+      virtual inode* getNode(name_id name) override;
       virtual void printMap() override;
-      virtual string getPwd() override;
-      virtual void setPwd(string newPwd) override;
+      virtual void printNames (ostream& out) override;
+      virtual void dismantle (vector<inode_ptr>& orphans) override;
+      virtual shared_mutex& getLock() override;
+      virtual inode* mount (const string& name, inode* source,
+                            uint64_t generation) override;
+      virtual bool isReadOnly() const override { return read_only; }
 };
 
 // class directory -
 // Used to map filenames onto inode pointers.
-// default ctor -
-//    Creates a new map with keys "." and "..".
+// ctor -
+//    Creates an empty map.  Dot (.) and dotdot (..) are not kept in
+//    the map but as the self and parent pointers, which lookups
+//    and listings treat as though they were dirents.
 // remove -
 //    Removes the file or subdirectory from the current inode.
 //    Throws an file_error if this is not a directory, the file
 //    does not exist, or the subdirectory is not empty.
 //    Here empty means the only entries are dot (.) and dotdot (..).
+// rmtree -
+//    Removes the file or subdirectory and everything under it.
+//    The subtree is taken apart with an explicit stack, so its
+//    depth is not limited by the C++ stack.  Removed nodes are
+//    retired, not freed.
 // mkdir -
 //    Creates a new directory under the current directory and
-//    immediately adds the directories dot (.) and dotdot (..) to it.
-//    Note that the parent (..) of / is / itself.  It is an error
-//    if the entry already exists.
+//    immediately points its dot (.) and dotdot (..) at itself and
+//    at this directory.  Note that the parent (..) of / is / itself.
+//    It is an error if the entry already exists.  Throws file_error
+//    if this directory has been removed, even if it is still some
+//    session's cwd, as nothing may be linked under it any more.
+// setPath -
+//    With the name dot or dotdot, sets the self or parent pointer.
+//    Any other name adds the node as an owned dirent.
+// getPath -
+//    The name under which this directory knows node:  dot, dotdot,
+//    or the node's own name if this directory owns it.  O(1).
+//    Throws file_error for any other node.
 // mkfile -
 //    Create a new empty text file with the given name.  Error if
-//    a dirent with that name exists.
+//    a dirent with that name exists.  Throws file_error like mkdir
+//    if this directory has been removed.
+// getNode -
+//    Looks up a dirent by interned name id.  The name id version
+//    is the one used to walk paths; the string version interns
+//    nothing and just forwards to it.
+// dismantle -
+//    Empties the directory, appending its children to orphans and
+//    clearing their parent pointers.  Used to take a tree apart
+//    without recursion.  Takes the lock itself.
+// size -
+//    The number of dirents, counting dot and dotdot.
+// printNames -
+//    Writes each name, dot and dotdot included, one per line in
+//    lexicographic order, straight from the dirents.
+// getSubdirs -
+//    Appends the subdirectories, other than dot and dotdot, in
+//    lexicographic order.
+// mount -
+//    Links a read-only directory named name that shows the
+//    directory source as it was in the snapshot of generation, and
+//    returns it.  Subdirectories that were themselves mounted
+//    snapshots are left out of it.  Anything that would change it
+//    or anything under it throws file_error, but it can be removed
+//    whole, which unmounts it.  The caller holds the lock.
+// isReadOnly -
+//    Whether this is a mounted snapshot, or a directory in one.
 
 class directory: public base_file {
+   friend class snapshot;
+   friend class tree_builder;
+   friend class tree_walker;
    private:
-      // Must be a map, not unordered_map, so printing is lexicographic
-      map<string,inode_ptr> dirents;
-      string fullPath;
+      // Kept in lexicographic order, so printing needs no sort.
+      dirent_table dirents;
+      node_arena* arena;
+      atomic<inode*> parent {nullptr};
+      shared_mutex lock;
+      atomic<bool> removed {false};
+      // Set while a tree_builder is making the subtree this is in.
+      bool building {false};
+      // Set only in a mounted snapshot, which shows source as it
+      // was at generation as_of once it has been filled.  Not
+      // owned, as nothing a snapshot can see is ever freed before
+      // the tree is.
+      inode* source {nullptr};
+      uint64_t as_of {0};
+      mutable once_flag filled;
+      void fill() const;
+      dirent_table::view entries() const;
+      void insert (const string& name, inode_ptr node);
+      inode_ptr detach (const string& name);
+      template <typename visitor>
+      void forEachName (visitor visit) const;
    public:
+      explicit directory (node_arena& arena_): arena (&arena_) {}
       virtual size_t size() const override;
-      virtual const wordvec& readfile() const override;
-      virtual void writefile (const wordvec& newdata) override;
+      virtual const file_data& readfile() const override;
+      virtual void writefile (file_data&& newdata) override;
       virtual void remove (const string& filename) override;
-      virtual inode_ptr mkdir (const string& dirname) override;
-      virtual inode_ptr mkfile (const string& filename) override;
-      virtual void setPath(const string& name, inode_ptr node) override;
-      virtual string getPath(inode_ptr node) override;
+      virtual void rmtree (const string& filename) override;
+      virtual inode* mkdir (const string& dirname) override;
+      virtual inode* mkfile (const string& filename) override;
+      virtual void setPath(const string& name, inode* node) override;
+      virtual string getPath(inode* node) override;
       virtual wordvec getAllPaths() override;
       virtual wordvec getAllDirs() override;
-      virtual inode_ptr getNode(const string& path) override;
+      virtual void getSubdirs (vector<inode*>& dirs) override;
+      virtual inode* getNode(const string& path) override;
+      virtual inode* getNode(name_id name) override;
       virtual void printMap() override;
-      virtual string getPwd() override;
-      virtual void setPwd(string newPwd) override;
+      virtual void printNames (ostream& out) override;
+      virtual void dismantle (vector<inode_ptr>& orphans) override;
+      virtual shared_mutex& getLock() override { return lock; }
+      virtual inode* mount (const string& name, inode* source,
+                            uint64_t generation) override;
+      virtual bool isReadOnly() const override {
+         return source != nullptr;
+      }
+};
+
+// tree_walker -
+//    Visits the directories of a subtree in preorder, subdirectories
+//    in lexicographic order, which is the order lsr prints them.
+//    Keeps one dirent iterator per level on an explicit stack and
+//    copies no names.  Each iterator goes through the version of
+//    the dirents that was in use when the walk came to it, so the
+//    walk takes no lock, and the caller must stay pinned to the
+//    epoch until it is done.
+// ctor -
+//    Starts at start, whose path is given, or else found from its
+//    parent links.
+// next -
+//    Returns the next directory, starting with the one the walker
+//    was made with, or nullptr when the walk is done.
+// path -
+//    The absolute path of the directory next last returned.  It is
+//    kept as one string that each level extends and truncates, so
+//    the walk shares every prefix instead of rebuilding each path.
+
+class tree_walker {
+   private:
+      using dirent_iter = dirent_table::const_iterator;
+      struct frame {
+         dirent_iter next;
+         dirent_iter end;
+         size_t length;
+      };
+      vector<frame> stack;
+      inode* start;
+      string path_;
+      void push (inode* dir);
+   public:
+      explicit tree_walker (inode* start_);
+      tree_walker (inode* start_, string path): start (start_),
+                   path_ (move (path)) {}
+      inode* next();
+      const string& path() const { return path_; }
+};
+
+// tree_builder -
+//    Adds many inodes at once, for loading a snapshot or importing
+//    a host directory.  Nothing is looked up by path.  A dirent
+//    whose name sorts after all the others in its directory goes
+//    in at the end of the map without comparing names, and totals
+//    are not carried up to the root for each inode.  Each new
+//    subtree is built out of the tree, where no path leads to it,
+//    without locks, and finish sums it once and links it into the
+//    directory that existed before, so that it appears whole.
+// add -
+//    Makes a new directory or plain file named name in dir, with
+//    data as the file's contents, and returns it.  Returns nullptr
+//    and adds nothing if the name is already taken.
+// finish -
+//    Brings the totals up to date and links in the new subtrees.
+//    One whose name another session took in the meantime, or whose
+//    directory was removed, is dropped.  The dtor calls it if no
+//    one else has.
+// was_dropped -
+//    Whether finish dropped the new subtree whose top is node.  The
+//    node may already be freed, and is only compared.
+
+class tree_builder {
+   private:
+      vector<inode*> added;
+      vector<pair<inode*,inode_ptr>> tops;
+      vector<const inode*> dropped;
+   public:
+      tree_builder() = default;
+      tree_builder (const tree_builder&) = delete;
+      tree_builder& operator= (const tree_builder&) = delete;
+      ~tree_builder() { finish(); }
+      inode* add (inode* dir, string_view name, file_type type,
+                  file_data&& data = file_data());
+      void finish();
+      bool was_dropped (const inode* node) const;
 };
 
 #endif
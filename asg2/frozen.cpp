@@ -0,0 +1,60 @@
+// $Id: frozen.cpp,v 1.1 $
+
+#include <iostream>
+
+using namespace std;
+
+#include "debug.h"
+#include "frozen.h"
+
+atomic<uint64_t> frozen::current {0};
+shared_mutex frozen::changing;
+mutex frozen::lock;
+map<string,uint64_t> frozen::taken;
+mutex frozen::stripes[stripe_count];
+
+// The commands that change the tree.
+static bool is_change (string_view command) {
+   static constexpr string_view changes[] {
+      "import", "load", "make", "mkdir", "mount", "rm", "rmr",
+   };
+   for (const auto& name: changes) if (command == name) return true;
+   return false;
+}
+
+bool frozen::take (const string& name) {
+   unique_lock<shared_mutex> quiet (changing);
+   lock_guard<mutex> guard (lock);
+   uint64_t generation = current.load (memory_order_relaxed);
+   if (not taken.emplace (name, generation).second) return false;
+   current.store (generation + 1, memory_order_release);
+   DEBUGF ('f', "snapshot " << name << " = " << generation);
+   return true;
+}
+
+bool frozen::find (const string& name, uint64_t& generation) {
+   lock_guard<mutex> guard (lock);
+   auto found = taken.find (name);
+   if (found == taken.end()) return false;
+   generation = found->second;
+   return true;
+}
+
+vector<string> frozen::names() {
+   lock_guard<mutex> guard (lock);
+   vector<string> result;
+   result.reserve (taken.size());
+   for (const auto& entry: taken) result.push_back (entry.first);
+   return result;
+}
+
+// Nodes are at least 16 bytes apart, so the low bits say nothing.
+mutex& frozen::history_lock (const void* owner) {
+   uintptr_t address = reinterpret_cast<uintptr_t> (owner);
+   return stripes[(address >> 4) % stripe_count];
+}
+
+shared_lock<shared_mutex> frozen::hold (string_view command) {
+   if (not is_change (command)) return shared_lock<shared_mutex>();
+   return shared_lock<shared_mutex> (changing);
+}
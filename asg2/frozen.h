@@ -0,0 +1,78 @@
+// $Id: frozen.h,v 1.1 $
+
+// frozen -
+//    Named snapshots of the whole tree, each taken in O(1):  taking
+//    one just moves the generation counter on.  Nothing is copied
+//    then.  Instead, when a change replaces a directory's dirent
+//    version or a plain file's contents that a snapshot may still
+//    see, the old one is kept, tagged with the generations it was
+//    in use for, rather than freed.  So a change after a snapshot
+//    costs one kept version of the node it changes, and a tree
+//    that has no snapshots keeps nothing.
+//
+//    A snapshot is looked at by mounting it, which links a read-only
+//    directory into the tree that shows / as it was.  It is filled
+//    in lazily, a directory at a time, as it is looked into.
+//    Snapshots live in memory only.  save leaves them and their
+//    mounts out, so a load, or a replay that starts from one,
+//    begins with none.
+
+#ifndef __FROZEN_H__
+#define __FROZEN_H__
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// frozen -
+//    static class for the snapshots taken so far.
+// generation -
+//    The number of snapshots taken.  A version that is published
+//    with generation g is seen by every snapshot from g on, up to
+//    the generation in which it is replaced.
+// take -
+//    Takes a snapshot named name and returns true, or returns false
+//    if the name is taken.  Waits until no command that changes the
+//    tree is running, so the snapshot sees each one whole.
+// find -
+//    Sets the generation of the snapshot named name and returns
+//    true, or returns false if there is none.
+// names -
+//    The names of the snapshots, in lexicographic order.
+// hold -
+//    For a command that changes the tree, returns a lock that keeps
+//    snapshots from being taken until it is done.  Otherwise returns
+//    a lock that holds nothing.
+// history_lock -
+//    The lock that guards what a node keeps for snapshots, one of a
+//    fixed set picked by the node's address.  Nothing else is locked
+//    while it is held, so a mounted snapshot can be filled under any
+//    other locks its caller holds.
+
+class frozen {
+   private:
+      static atomic<uint64_t> current;
+      static shared_mutex changing;
+      static mutex lock;
+      static map<string,uint64_t> taken;
+      static constexpr size_t stripe_count = 64;
+      static mutex stripes[stripe_count];
+   public:
+      static uint64_t generation() {
+         return current.load (memory_order_acquire);
+      }
+      static bool take (const string& name);
+      static bool find (const string& name, uint64_t& generation);
+      static vector<string> names();
+      static shared_lock<shared_mutex> hold (string_view command);
+      static mutex& history_lock (const void* owner);
+};
+
+#endif
+
@@ -0,0 +1,237 @@
+// $Id: hostfs.cpp,v 1.1 $
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "hostfs.h"
+#include "snapshot.h"
+
+// host_walk -
+//    What the tasks of one import or export share:  the pool, the
+//    errors they ran into, and, without a pool, the directories
+//    still to be done.
+// spawn -
+//    Queues the work for one directory.
+// run -
+//    Returns once everything spawned, and everything that spawned,
+//    is done.
+// fail -
+//    Records an error.  Safe to call from any task.
+// check -
+//    Throws file_error for the first error, if there were any.
+
+class host_walk {
+   private:
+      work_pool* pool;
+      task_group group;
+      vector<function<void()>> pending;
+      mutex lock;
+      vector<string> errors;
+   public:
+      explicit host_walk (work_pool* pool_): pool (pool_) {}
+      void spawn (function<void()> task);
+      void run();
+      void fail (const string& what);
+      void check();
+};
+
+void host_walk::spawn (function<void()> task) {
+   if (pool != nullptr) pool->submit (group, move (task));
+                   else pending.push_back (move (task));
+}
+
+void host_walk::run() {
+   if (pool != nullptr) {
+      pool->wait (group);
+      return;
+   }
+   while (not pending.empty()) {
+      function<void()> task = move (pending.back());
+      pending.pop_back();
+      task();
+   }
+}
+
+void host_walk::fail (const string& what) {
+   lock_guard<mutex> guard (lock);
+   errors.push_back (what);
+}
+
+void host_walk::check() {
+   if (errors.empty()) return;
+   string what = errors.front();
+   if (errors.size() > 1) {
+      what += " (and " + to_string (errors.size() - 1) + " more errors)";
+   }
+   throw file_error (what);
+}
+
+// host_entry -
+//    What import learns about one host file or directory before
+//    any of it goes into the tree.  Children are sorted by name.
+
+struct host_entry {
+   string name;
+   bool is_dir;
+   file_data data;
+   vector<host_entry> children;
+};
+
+static void read_file (host_walk& walk, host_entry& entry,
+                       const string& path) {
+   try {
+      mapped_file file (path);
+      viewvec words;
+      split_views (string_view (file.data(), file.size()),
+                   " \t\n\r\f\v", words);
+      entry.data = file_data (words.begin(), words.end());
+   }catch (file_error& error) {
+      walk.fail (error.what());
+   }
+}
+
+// Lists one directory, reads its files, and spawns its
+// subdirectories.  The children vector is complete before any
+// task is handed a reference into it.
+static void read_dir (host_walk& walk, host_entry& entry,
+                      const string& path) {
+   DIR* handle = opendir (path.c_str());
+   if (handle == nullptr) {
+      walk.fail (path + ": " + strerror (errno));
+      return;
+   }
+   while (dirent* found = readdir (handle)) {
+      string_view name (found->d_name);
+      if (name == "." or name == "..") continue;
+      unsigned char type = found->d_type;
+      if (type == DT_UNKNOWN) {
+         struct stat info;
+         string child_path = path + "/" + string (name);
+         if (lstat (child_path.c_str(), &info) == 0) {
+            type = S_ISDIR (info.st_mode) ? DT_DIR
+                 : S_ISREG (info.st_mode) ? DT_REG : DT_UNKNOWN;
+         }
+      }
+      if (type != DT_DIR and type != DT_REG) continue;
+      entry.children.push_back ({string (name), type == DT_DIR, {}, {}});
+   }
+   closedir (handle);
+   sort (entry.children.begin(), entry.children.end(),
+         [] (const host_entry& left, const host_entry& right) {
+            return left.name < right.name;
+         });
+   for (host_entry& child: entry.children) {
+      string child_path = path + "/" + child.name;
+      if (child.is_dir) {
+         walk.spawn ([&walk, &child, child_path] {
+            read_dir (walk, child, child_path);
+         });
+      }else {
+         read_file (walk, child, child_path);
+      }
+   }
+}
+
+bool host_tree::is_dir (const string& path) {
+   struct stat info;
+   return stat (path.c_str(), &info) == 0 and S_ISDIR (info.st_mode);
+}
+
+size_t host_tree::import_dir (work_pool* pool, const string& hostdir,
+                              inode* dir) {
+   host_walk walk (pool);
+   host_entry top {hostdir, true, {}, {}};
+   walk.spawn ([&walk, &top, &hostdir] {
+      read_dir (walk, top, hostdir);
+   });
+   walk.run();
+
+   // Only this thread touches the tree.  Each directory's children
+   // are sorted, so each goes in at the end of its dirents.
+   size_t count = 0;
+   tree_builder builder;
+   vector<pair<host_entry*,inode*>> stack {{&top, dir}};
+   while (not stack.empty()) {
+      auto [entry, target] = stack.back();
+      stack.pop_back();
+      for (host_entry& child: entry->children) {
+         inode* node = builder.add (target, child.name,
+                                    child.is_dir ? file_type::DIRECTORY_TYPE
+                                                 : file_type::PLAIN_TYPE,
+                                    move (child.data));
+         if (node == nullptr) continue;
+         ++count;
+         if (child.is_dir) stack.push_back ({&child, node});
+      }
+   }
+   builder.finish();
+   DEBUGF ('h', "imported " << count << " inodes from " << hostdir);
+   walk.check();
+   return count;
+}
+
+static void write_file (host_walk& walk, inode* file,
+                        const string& path) {
+   int fd = open (path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (fd < 0) {
+      walk.fail (path + ": " + strerror (errno));
+      return;
+   }
+   const string& text = file->getContents()->readfile().text();
+   bool written = write_all (fd, text.data(), text.size())
+              and (text.empty() or write_all (fd, "\n", 1));
+   if (not written) walk.fail (path + ": " + strerror (errno));
+   close (fd);
+}
+
+// The tree is only read while exporting, so tasks may walk it
+// concurrently.  Each holds its directory shared while it writes
+// the files in it.
+static void write_dir (host_walk& walk, atomic<size_t>& count,
+                       inode* dir, const string& path) {
+   if (mkdir (path.c_str(), 0777) < 0 and errno != EEXIST) {
+      walk.fail (path + ": " + strerror (errno));
+      return;
+   }
+   ++count;
+   base_file* contents = dir->getContents();
+   read_lock guard (contents->getLock());
+   for (const string& name: contents->getAllPaths()) {
+      if (name == "." or name == "..") continue;
+      inode* node = contents->getNode (name);
+      string child_path = path + "/" + name;
+      if (node->isDirectory()) {
+         walk.spawn ([&walk, &count, node, child_path] {
+            write_dir (walk, count, node, child_path);
+         });
+      }else {
+         write_file (walk, node, child_path);
+         ++count;
+      }
+   }
+}
+
+size_t host_tree::export_dir (work_pool* pool, inode* dir,
+                              const string& hostdir) {
+   host_walk walk (pool);
+   atomic<size_t> count {0};
+   walk.spawn ([&walk, &count, dir, &hostdir] {
+      write_dir (walk, count, dir, hostdir);
+   });
+   walk.run();
+   DEBUGF ('h', "exported " << count << " files to " << hostdir);
+   walk.check();
+   return count;
+}
+
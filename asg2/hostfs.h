@@ -0,0 +1,51 @@
+// $Id: hostfs.h,v 1.1 $
+
+// hostfs -
+//    Copies trees between the host's filesystem and this one.
+//    Reading and writing the host is spread over a work pool, one
+//    task per directory.  On import, the pool only builds a plain
+//    description of the host tree, with each file mapped and split
+//    into words as it is read.  The tree itself is then changed by
+//    one thread, through a tree_builder, so nothing in it needs to
+//    be locked and no path is looked up per file.
+
+#ifndef __HOSTFS_H__
+#define __HOSTFS_H__
+
+#include <string>
+using namespace std;
+
+#include "file_sys.h"
+#include "workpool.h"
+
+// host_tree -
+//    static class for copying whole trees.
+// is_dir -
+//    Whether path names a directory on the host.
+// import_dir -
+//    Copies everything under the host directory hostdir into dir.
+//    Host files are split into words at white space.  Symbolic
+//    links and special files are skipped, and so is any entry
+//    whose name is already taken in dir.  Returns the number of
+//    inodes added.
+// export_dir -
+//    Copies everything under dir into hostdir, which is made if
+//    it does not exist, writing each file as its text and a
+//    newline.  Returns the number of host files and directories
+//    written.
+//
+// With a null pool the work is done on the calling thread.  Both
+// do as much as they can and then throw file_error if anything on
+// the host could not be read or written.
+
+class host_tree {
+   public:
+      static bool is_dir (const string& path);
+      static size_t import_dir (work_pool* pool, const string& hostdir,
+                                inode* dir);
+      static size_t export_dir (work_pool* pool, inode* dir,
+                                const string& hostdir);
+};
+
+#endif
+
@@ -0,0 +1,78 @@
+// $Id: inodes.cpp,v 1.1 $
+
+#include <iostream>
+#include <mutex>
+
+using namespace std;
+
+#include "dcache.h"
+#include "debug.h"
+#include "inodes.h"
+
+// Number zero is never handed out.
+vector<inode*> inode_table::slots {nullptr};
+vector<int> inode_table::free_numbers;
+size_t inode_table::live {0};
+shared_mutex inode_table::lock;
+
+void inode_table::add (inode* node) {
+   unique_lock<shared_mutex> guard (lock);
+   int nr;
+   if (free_numbers.empty()) {
+      nr = static_cast<int> (slots.size());
+      slots.push_back (node);
+   }else {
+      nr = free_numbers.back();
+      free_numbers.pop_back();
+      slots[nr] = node;
+   }
+   node->inode_nr = nr;
+   ++live;
+}
+
+// Not every inode is taken apart by destroy_tree before it is
+// freed, and the next inode may get its number or its address, so
+// the dentry_cache is told here that whatever it kept for this one
+// is no longer good.
+void inode_table::remove (int nr) {
+   dentry_cache::invalidate (slots[nr]);
+   unique_lock<shared_mutex> guard (lock);
+   slots[nr] = nullptr;
+   free_numbers.push_back (nr);
+   --live;
+}
+
+// An inode whose last owner has let go is still in the table until
+// its dtor takes it out, which waits on the lock held here, so the
+// inode can still be asked for an owner and just has none.
+inode_ptr inode_table::find (int nr) {
+   shared_lock<shared_mutex> guard (lock);
+   if (nr <= 0 or static_cast<size_t> (nr) >= slots.size()) return nullptr;
+   inode* node = slots[nr];
+   return node == nullptr ? nullptr : node->weak_from_this().lock();
+}
+
+int inode_table::limit() {
+   shared_lock<shared_mutex> guard (lock);
+   return static_cast<int> (slots.size());
+}
+
+size_t inode_table::count() {
+   shared_lock<shared_mutex> guard (lock);
+   return live;
+}
+
+// Fills batch with the next live inodes from number from on, and
+// returns the number to go on from, or zero past the end.
+size_t inode_table::gather (size_t from, vector<inode_ptr>& batch) {
+   batch.clear();
+   shared_lock<shared_mutex> guard (lock);
+   size_t nr = from;
+   for (; nr < slots.size() and batch.size() < batch_size; ++nr) {
+      if (slots[nr] == nullptr) continue;
+      inode_ptr node = slots[nr]->weak_from_this().lock();
+      if (node != nullptr) batch.push_back (move (node));
+   }
+   DEBUGF ('t', "gathered " << batch.size() << " from " << from);
+   return nr < slots.size() ? nr : 0;
+}
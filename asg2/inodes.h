@@ -0,0 +1,79 @@
+// $Id: inodes.h,v 1.1 $
+
+// inodes -
+//    Every live inode by number.  Numbers are kept dense:  the
+//    number of an inode that is freed goes on a free list and is
+//    handed to the next inode made, so the table is never much
+//    larger than the tree.  A tool that has to look at every inode,
+//    and not at the tree's shape, can go down the table in order
+//    instead of walking the directories.
+
+#ifndef __INODES_H__
+#define __INODES_H__
+
+#include <cstddef>
+#include <shared_mutex>
+#include <vector>
+using namespace std;
+
+#include "file_sys.h"
+
+// inode_table -
+//    static class for the process wide table.
+// add -
+//    Gives a new inode the number at the top of the free list, or
+//    else the next number never used, and enters it in the table.
+//    Called by inode::make once the inode is owned by its shared_ptr.
+// remove -
+//    Takes the inode with number nr out of the table and frees the
+//    number, and moves its stamp on in the dentry_cache.  Called by
+//    the inode's dtor.
+// find -
+//    The inode numbered nr, or nullptr if there is none or it is
+//    being freed.  The shared_ptr returned keeps it alive.
+// limit -
+//    One past the highest number in the table, whether in use or on
+//    the free list.
+// count -
+//    The number of inodes in the table.
+// scan -
+//    Calls visit with each inode in the table in order of number.
+//    Inodes are taken out a batch at a time under the lock and
+//    visited after it is released, so visit may do anything but
+//    expect a consistent picture of the tree as a whole.
+//
+// Any thread may call these at any time.  Lookups share a lock,
+// and only adding and removing inodes exclude them.  An inode found
+// here need not be in the tree:  it may have been removed, or be in
+// a subtree that a tree_builder is still making, whose directories
+// must not be looked into until it is linked in.
+
+class inode_table {
+   private:
+      static constexpr size_t batch_size = 256;
+      static vector<inode*> slots;
+      static vector<int> free_numbers;
+      static size_t live;
+      static shared_mutex lock;
+      static size_t gather (size_t from, vector<inode_ptr>& batch);
+   public:
+      static void add (inode* node);
+      static void remove (int nr);
+      static inode_ptr find (int nr);
+      static int limit();
+      static size_t count();
+      template <typename visitor>
+      static void scan (visitor visit);
+};
+
+template <typename visitor>
+void inode_table::scan (visitor visit) {
+   vector<inode_ptr> batch;
+   for (size_t next = 1; next != 0; ) {
+      next = gather (next, batch);
+      for (const inode_ptr& node: batch) visit (node.get());
+   }
+}
+
+#endif
+
@@ -0,0 +1,406 @@
+// $Id: journal.cpp,v 1.1 $
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "debug.h"
+#include "journal.h"
+#include "snapshot.h"
+
+// The file starts with a header, which is followed by frames.  A
+// frame is the length of its payload, a checksum of the payload,
+// and the payload:  a kind byte, a string count, and each string
+// as its length and bytes.  A command has the cwd path and then
+// the words; a checkpoint has the snapshot name.
+
+static constexpr char journal_magic[8] {'y','s','h','j','r','n','l','\0'};
+static constexpr uint32_t journal_version = 1;
+static constexpr size_t header_size = sizeof journal_magic + 8;
+static constexpr size_t frame_size = 8;
+static constexpr char command_kind = 'C';
+static constexpr char checkpoint_kind = 'K';
+static constexpr size_t max_buffered = 1 << 20;
+
+mutex journal::order;
+mutex journal::lock;
+int journal::fd {-1};
+string journal::filename;
+string journal::buffer;
+chrono::milliseconds journal::interval {100};
+journal::clock::time_point journal::last_sync;
+journal::clock::duration journal::overhead {};
+size_t journal::records {0};
+size_t journal::syncs {0};
+thread journal::syncer;
+condition_variable journal::buffered;
+bool journal::stopping {false};
+
+static uint32_t checksum (const char* data, size_t size) {
+   uint32_t hash = 2166136261u;
+   for (size_t index = 0; index < size; ++index) {
+      hash = (hash ^ static_cast<unsigned char> (data[index])) * 16777619u;
+   }
+   return hash;
+}
+
+static void put_u32 (string& out, uint32_t value) {
+   out.append (reinterpret_cast<const char*> (&value), sizeof value);
+}
+
+static uint32_t get_u32 (const char* data) {
+   uint32_t value;
+   memcpy (&value, data, sizeof value);
+   return value;
+}
+
+static string journal_header() {
+   string head (journal_magic, sizeof journal_magic);
+   put_u32 (head, journal_version);
+   put_u32 (head, 0);
+   return head;
+}
+
+static string frame (char kind, const viewvec& strings) {
+   string payload (1, kind);
+   put_u32 (payload, static_cast<uint32_t> (strings.size()));
+   for (const auto& item: strings) {
+      put_u32 (payload, static_cast<uint32_t> (item.size()));
+      payload += item;
+   }
+   string out;
+   put_u32 (out, static_cast<uint32_t> (payload.size()));
+   put_u32 (out, checksum (payload.data(), payload.size()));
+   return out + payload;
+}
+
+// Decodes the payload of a frame.  Returns false if it is not well
+// formed, which the checksum should already have ruled out.
+static bool unframe (const char* payload, size_t size, char& kind,
+                     viewvec& strings) {
+   strings.clear();
+   if (size < 5) return false;
+   kind = payload[0];
+   uint32_t count = get_u32 (payload + 1);
+   size_t pos = 5;
+   for (uint32_t index = 0; index < count; ++index) {
+      if (size - pos < 4) return false;
+      uint32_t length = get_u32 (payload + pos);
+      pos += 4;
+      if (size - pos < length) return false;
+      strings.emplace_back (payload + pos, length);
+      pos += length;
+   }
+   return pos == size;
+}
+
+static inode* slash_of (inode_state& state) {
+   return state.getRoot()->getContents()->getNode ("/");
+}
+
+// A directory that has been removed can still be the cwd.
+static bool attached (inode* node, inode* slash) {
+   for (; node != nullptr; node = node->getParent()) {
+      if (node == slash) return true;
+   }
+   return false;
+}
+
+// Finds a cwd from its path without going through the dentry
+// cache, which would otherwise fill with one long path for every
+// record replayed in a deep directory.
+static inode* find_dir (string_view path, inode* slash) {
+   inode* dir = slash;
+   path_walker walker (path);
+   string_view component;
+   while (dir != nullptr and walker.next (component)) {
+      name_id name = name_table::find (component);
+      dir = name == name_table::no_name or not dir->isDirectory()
+          ? nullptr : dir->getContents()->getNode (name);
+   }
+   return dir;
+}
+
+// Points cout at another buffer for as long as it lives, so that
+// cout gets its own back however replay ends.
+class cout_redirect {
+   private:
+      streambuf* saved;
+   public:
+      explicit cout_redirect (streambuf* buf): saved (cout.rdbuf (buf)) {}
+      ~cout_redirect() { cout.rdbuf (saved); }
+      cout_redirect (const cout_redirect&) = delete;
+      cout_redirect& operator= (const cout_redirect&) = delete;
+};
+
+// Whether a command is journaled, as a change or a checkpoint.
+static bool is_logged (string_view command) {
+   static constexpr string_view logged[] {
+      "import", "load", "make", "mkdir", "mount", "rm", "rmr", "save",
+      "snapshot",
+   };
+   for (const auto& name: logged) if (command == name) return true;
+   return false;
+}
+
+void journal::set_sync_interval (size_t milliseconds) {
+   interval = chrono::milliseconds (milliseconds);
+}
+
+size_t journal::replay (inode_state& state, const char* data,
+                        size_t size, size_t& good_size) {
+   // First find where the good frames end and the last checkpoint.
+   size_t pos = header_size;
+   size_t start = header_size;
+   string snapshot_name;
+   char kind;
+   viewvec strings;
+   while (size - pos >= frame_size) {
+      uint32_t length = get_u32 (data + pos);
+      if (size - pos - frame_size < length) break;
+      const char* payload = data + pos + frame_size;
+      if (checksum (payload, length) != get_u32 (data + pos + 4)) break;
+      if (not unframe (payload, length, kind, strings)) break;
+      pos += frame_size + length;
+      if (kind == checkpoint_kind and strings.size() == 1) {
+         snapshot_name = string (strings[0]);
+         start = pos;
+      }
+   }
+   good_size = pos;
+   if (snapshot_name != "") snapshot::load (state, snapshot_name);
+
+   // Then rerun each command after it, from the cwd it ran in,
+   // with its output thrown away.
+   inode* slash = slash_of (state);
+   inode_ptr saved_cwd = state.getCwd()->shared_from_this();
+   cout_redirect discard (nullptr);
+   size_t replayed = 0;
+   // Consecutive records tend to run in the same directory or one
+   // below it, so each cwd is found from the one before when that
+   // is a prefix.  Only rm and rmr can take the earlier one away.
+   string last_path;
+   inode* last_cwd = nullptr;
+   for (pos = start; pos < good_size; ) {
+      uint32_t length = get_u32 (data + pos);
+      unframe (data + pos + frame_size, length, kind, strings);
+      pos += frame_size + length;
+      if (kind != command_kind or strings.size() < 2) continue;
+      string_view path = strings[0];
+      bool below_last = last_cwd != nullptr
+                    and path.substr (0, last_path.size()) == last_path
+                    and (path.size() == last_path.size()
+                         or path[last_path.size()] == '/');
+      inode* cwd = below_last
+                 ? find_dir (path.substr (last_path.size()), last_cwd)
+                 : find_dir (path, slash);
+      if (cwd == nullptr or not cwd->isDirectory()) continue;
+      viewvec words (strings.begin() + 1, strings.end());
+      command_fn fn = find_command_fn (words[0]);
+      if (fn == nullptr) continue;
+      state.setCwd (cwd);
+      try {
+         fn (state, words);
+      }catch (command_error&) {
+         // It failed the same way the first time.
+      }catch (file_error&) {
+         // The host directory of an import may have changed since,
+         // and execute reports such an error without stopping.
+      }
+      if (words[0] == "rm" or words[0] == "rmr") {
+         last_cwd = nullptr;
+      }else {
+         last_path.assign (path);
+         last_cwd = cwd;
+      }
+      ++replayed;
+   }
+   state.setCwd (attached (saved_cwd.get(), slash) ? saved_cwd.get()
+                                                   : slash);
+   DEBUGF ('J', "replayed " << replayed << " commands after "
+          << (snapshot_name == "" ? "an empty tree" : snapshot_name));
+   return replayed;
+}
+
+void journal::open (inode_state& state, const string& filename_,
+                    const string& loaded) {
+   filename = filename_;
+   auto start = clock::now();
+   size_t replayed = 0;
+   struct stat info;
+   bool recovering = stat (filename.c_str(), &info) == 0
+                     and info.st_size > 0;
+   if (recovering) {
+      mapped_file file (filename);
+      if (file.size() < header_size
+      or memcmp (file.data(), journal_magic, sizeof journal_magic) != 0
+      or get_u32 (file.data() + sizeof journal_magic) != journal_version) {
+         throw file_error (filename + ": not a journal");
+      }
+      size_t good_size;
+      replayed = replay (state, file.data(), file.size(), good_size);
+      if (good_size < file.size()) {
+         complain() << filename << ": discarded "
+                    << file.size() - good_size
+                    << " bytes of torn journal" << endl;
+         if (truncate (filename.c_str(), good_size) < 0) {
+            throw file_error (filename + ": " + strerror (errno));
+         }
+      }
+   }
+   fd = ::open (filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0666);
+   if (fd < 0) throw file_error (filename + ": " + strerror (errno));
+   if (not recovering) {
+      string head = journal_header();
+      if (not write_all (fd, head.data(), head.size())) {
+         throw file_error (filename + ": " + strerror (errno));
+      }
+      // A new journal starts from the snapshot loaded at startup.
+      char* absolute = loaded == "" ? nullptr
+                     : realpath (loaded.c_str(), nullptr);
+      if (absolute != nullptr) {
+         checkpoint (absolute);
+         free (absolute);
+      }
+   }
+   last_sync = clock::now();
+   stopping = false;
+   syncer = thread (sync_loop);
+   if (recovering) {
+      chrono::duration<double> elapsed = last_sync - start;
+      cerr << execname() << ": recovered " << replayed
+           << " commands from " << filename << " in "
+           << elapsed.count() << " s" << endl;
+   }
+}
+
+unique_lock<mutex> journal::hold (const viewvec& words) {
+   if (fd < 0 or not is_logged (words[0])) return {};
+   return unique_lock<mutex> (order);
+}
+
+void journal::record (inode_state& state, const viewvec& words) {
+   if (not is_logged (words[0])) return;
+   lock_guard<mutex> guard (lock);
+   if (words[0] == "save" or words[0] == "load") {
+      if (words.size() < 2) return;
+      auto start = clock::now();
+      char* absolute = realpath (string (words[1]).c_str(), nullptr);
+      if (absolute != nullptr) {
+         checkpoint (absolute);
+         free (absolute);
+      }
+      overhead += clock::now() - start;
+      return;
+   }
+   auto start = clock::now();
+   // Changes under a removed cwd can never be seen again.
+   string cwd_path = state.getCwd()->getFullPath();
+   if (cwd_path.empty()) return;
+   static viewvec strings;
+   strings.clear();
+   strings.push_back (cwd_path);
+   strings.insert (strings.end(), words.begin(), words.end());
+   append (command_kind, strings);
+   overhead += clock::now() - start;
+}
+
+void journal::append (char kind, const viewvec& strings) {
+   bool was_empty = buffer.empty();
+   buffer += frame (kind, strings);
+   ++records;
+   if (buffer.size() >= max_buffered
+   or clock::now() - last_sync >= interval) flush();
+   else if (was_empty) buffered.notify_one();
+}
+
+// Sleeps until something is buffered, then until the interval since
+// the last sync is up, and writes it.  A flush by someone else in
+// the meantime just moves the deadline on.
+void journal::sync_loop() {
+   unique_lock<mutex> guard (lock);
+   while (not stopping) {
+      if (buffer.empty()) {
+         buffered.wait (guard);
+      }else if (clock::now() - last_sync >= interval) {
+         flush();
+      }else {
+         buffered.wait_until (guard, last_sync + interval);
+      }
+   }
+}
+
+// Everything before a checkpoint is in its snapshot, so the journal
+// is replaced by one holding only the checkpoint.  The new file is
+// complete and synced before it is renamed over the old one.
+void journal::checkpoint (const string& snapshot_name) {
+   buffer.clear();
+   string tempname = filename + ".tmp";
+   int newfd = ::open (tempname.c_str(),
+                       O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0666);
+   string contents = journal_header()
+                   + frame (checkpoint_kind, {snapshot_name});
+   if (newfd < 0 or not write_all (newfd, contents.data(), contents.size())
+   or fdatasync (newfd) < 0
+   or rename (tempname.c_str(), filename.c_str()) < 0) {
+      complain() << tempname << ": " << strerror (errno) << endl;
+      if (newfd >= 0) ::close (newfd);
+      return;
+   }
+   ::close (fd);
+   fd = newfd;
+   if (not sync_parent (filename)) {
+      complain() << filename << ": " << strerror (errno) << endl;
+   }
+   ++syncs;
+   last_sync = clock::now();
+   DEBUGF ('J', "checkpoint " << snapshot_name);
+}
+
+void journal::flush() {
+   if (buffer.empty()) return;
+   if (not write_all (fd, buffer.data(), buffer.size())
+   or fdatasync (fd) < 0) {
+      complain() << filename << ": " << strerror (errno) << endl;
+   }
+   DEBUGF ('J', "synced " << buffer.size() << " bytes");
+   buffer.clear();
+   ++syncs;
+   last_sync = clock::now();
+}
+
+void journal::sync() {
+   if (fd < 0) return;
+   lock_guard<mutex> guard (lock);
+   auto start = clock::now();
+   flush();
+   overhead += clock::now() - start;
+}
+
+void journal::close() {
+   if (fd < 0) return;
+   {
+      lock_guard<mutex> guard (lock);
+      stopping = true;
+   }
+   buffered.notify_one();
+   syncer.join();
+   sync();
+   ::close (fd);
+   fd = -1;
+   cerr << execname() << ": journal: " << records << " records, "
+        << syncs << " syncs";
+   if (records > 0) {
+      chrono::duration<double,micro> each = overhead / records;
+      cerr << ", " << each.count() << " us/command";
+   }
+   cerr << endl;
+}
+
@@ -0,0 +1,103 @@
+// $Id: journal.h,v 1.1 $
+
+// journal -
+//    Write-ahead log of the commands that change the tree, so that
+//    a run which dies part way can be recovered.  Each of make,
+//    mkdir, rm, rmr, and import that completes is appended as a
+//    record holding the path of the cwd and the command words.  An
+//    import is replayed by reading the host directory again.  save and
+//    load are checkpoints:  the journal is rewritten to hold just
+//    the name of the snapshot, since that snapshot now stands for
+//    everything before it.
+//
+//    Records are buffered and written with one fdatasync per batch
+//    (group commit).  A sync thread writes a batch once the sync
+//    interval has passed since the last sync, whether or not more
+//    records follow, and the shell writes one whenever it is about
+//    to wait on a terminal.  A crash loses at most the last
+//    interval.
+//
+//    Each record is framed by its length and a checksum, so a torn
+//    write at the end of the file is recognized and cut off during
+//    recovery instead of being replayed.
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+using namespace std;
+
+#include "file_sys.h"
+#include "util.h"
+
+// journal -
+//    static class for the process wide journal.
+// open -
+//    Recovers from filename, if it exists:  loads the snapshot of
+//    its last checkpoint, then replays the commands after it.
+//    Reports the recovery time on cerr, and from then on appends
+//    to the file, with the sync thread running.  A new journal starts with a checkpoint of the
+//    snapshot loaded at startup, if any.  Throws file_error if the
+//    file can not be used.
+// is_open -
+//    Whether commands are being journaled.
+// hold -
+//    Called before a command runs.  If the command will be
+//    journaled, returns the lock that orders journaled commands, for
+//    the caller to hold until the command is recorded.  Otherwise
+//    returns a lock that holds nothing.  Server sessions change the
+//    tree at once, and this keeps the records in the order their
+//    changes were made, which replay depends on.  It also gives
+//    save a tree that no journaled command is changing.
+// record -
+//    Called after each command that completed.  Appends it if it
+//    changes the tree, and checkpoints after save and load.
+// sync -
+//    Writes and syncs whatever is buffered.
+// close -
+//    Stops the sync thread, syncs, closes, and reports the per-command overhead on cerr.
+// set_sync_interval -
+//    Longest time a record may sit unsynced, in milliseconds.
+//    Zero syncs every record.
+
+class journal {
+   private:
+      using clock = chrono::steady_clock;
+      static mutex order;
+      static mutex lock;
+      static int fd;
+      static string filename;
+      static string buffer;
+      static chrono::milliseconds interval;
+      static clock::time_point last_sync;
+      static clock::duration overhead;
+      static size_t records;
+      static size_t syncs;
+      static thread syncer;
+      static condition_variable buffered;
+      static bool stopping;
+      static void sync_loop();
+      static void append (char kind, const viewvec& strings);
+      static void checkpoint (const string& snapshot_name);
+      static void flush();
+      static size_t replay (inode_state& state, const char* data,
+                            size_t size, size_t& good_size);
+   public:
+      static void open (inode_state& state, const string& filename,
+                        const string& loaded);
+      static bool is_open() { return fd >= 0; }
+      static unique_lock<mutex> hold (const viewvec& words);
+      static void record (inode_state& state, const viewvec& words);
+      static void sync();
+      static void close();
+      static void set_sync_interval (size_t milliseconds);
+};
+
+#endif
+
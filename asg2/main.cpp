@@ -1,9 +1,13 @@
 // $Id: main.cpp,v 1.9 2016-01-14 16:16:52-08 - - $
 
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <utility>
+#include <fcntl.h>
 #include <unistd.h>
 
 using namespace std;
@@ -11,85 +15,203 @@ using namespace std;
 #include "commands.h"
 #include "debug.h"
 #include "file_sys.h"
+#include "journal.h"
+#include "output.h"
+#include "script.h"
+#include "server.h"
+#include "snapshot.h"
 #include "util.h"
 
 // scan_options
-//    Options analysis:  The only option is -Dflags.
+//    Options analysis:  -@flags sets debug flags, -j threads lets
+//    lsr, import, and export use that many threads, and -l snapshot
+//    loads a saved tree at startup.  -J journal recovers from and
+//    then appends to a journal, synced at most every -g
+//    milliseconds.  -S socket serves sessions on a Unix socket
+//    instead of reading commands.  The one operand permitted is a
+//    script to run in batch mode.
 
-void scan_options (int argc, char** argv) {
+struct options {
+   string script;
+   string snapshot;
+   string journal;
+   string socket;
+};
+
+options scan_options (int argc, char** argv) {
+   options opts;
    opterr = 0;
    for (;;) {
-      int option = getopt (argc, argv, "@:");
+      int option = getopt (argc, argv, "@:g:j:J:l:S:");
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 'g':
+            journal::set_sync_interval (strtoul (optarg, nullptr, 10));
+            break;
+         case 'j':
+            set_worker_threads (strtoul (optarg, nullptr, 10));
+            break;
+         case 'J':
+            opts.journal = optarg;
+            break;
+         case 'l':
+            opts.snapshot = optarg;
+            break;
+         case 'S':
+            opts.socket = optarg;
+            break;
          default:
             complain() << "-" << static_cast<char> (option)
                        << ": invalid option" << endl;
             break;
       }
    }
-   if (optind < argc) {
-      complain() << "operands not permitted" << endl;
+   if (optind + 1 < argc) {
+      complain() << "only one operand permitted" << endl;
+   }
+   if (optind < argc) opts.script = argv[optind];
+   return opts;
+}
+
+// run_script -
+//    Batch mode:  runs each line of a script with no prompt and no
+//    echo, reading the file in large blocks.  When done, reports
+//    the number of commands run and the rate to cerr.
+
+void run_script (inode_state& state, const string& filename) {
+   int fd = open (filename.c_str(), O_RDONLY);
+   if (fd < 0) {
+      complain() << filename << ": " << strerror (errno) << endl;
+      return;
+   }
+   line_reader reader (fd);
+   size_t commands = 0;
+   auto start = chrono::steady_clock::now();
+   try {
+      string_view line;
+      viewvec words;
+      while (reader.next (line)) {
+         split_views (line, " \t", words);
+         if (words.size() <= 0) continue;
+         ++commands;
+         execute (state, words);
+      }
+   } catch (ysh_exit&) {
+      // This catch intentionally left blank.
+   }
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+   if (reader.failed()) {
+      complain() << filename << ": " << strerror (errno) << endl;
+   }
+   close (fd);
+   cout.flush();
+   cerr << execname() << ": " << commands << " commands in "
+        << elapsed.count() << " s, "
+        << (elapsed.count() > 0 ? commands / elapsed.count() : 0)
+        << " commands/s" << endl;
+}
+
+// run_interactive -
+//    Loops reading commands from standard input until end of file,
+//    printing the prompt and, if needed, echoing each line.  Input
+//    goes through the same line_reader as a script, so a redirected
+//    file is mapped and its words are views into the mapping.
+
+void run_interactive (inode_state& state, output_sink& sink,
+                      bool need_echo) {
+   line_reader reader (STDIN_FILENO);
+   bool from_terminal = isatty (STDIN_FILENO);
+   string_view line;
+   viewvec words;
+   try {
+      for (;;) {
+         // Read a line, break at EOF, and echo print the prompt
+         // if one is needed.
+         cout << state.prompt();
+         sink.end_command();
+         // Nothing may sit unsynced while we wait on a person.
+         if (from_terminal) journal::sync();
+         if (not reader.next (line)) {
+            if (need_echo) cout << "^D";
+            cout << '\n';
+            DEBUGF ('y', "EOF");
+            break;
+         }
+         if (need_echo) cout << line << '\n';
+
+         // Split the line into words and lookup the appropriate
+         // function.  Complain or call it.
+         split_views (line, " \t", words);
+         DEBUGF ('y', "words = " << words);
+         if (words.size() <= 0)
+            continue;
+         execute (state, words);
+      }
+   } catch (ysh_exit&) {
+      // This catch intentionally left blank.
+   }
+   if (reader.failed()) {
+      complain() << "stdin: " << strerror (errno) << endl;
    }
 }
 
 // main -
-//    Main program which loops reading commands until end of file.
+//    Main program which sets up the shell and then either runs a
+//    script or loops reading commands until end of file.
 
 int main (int argc, char** argv) {
    execname (argv[0]);
    cout << boolalpha;  // Print false or true instead of 0 or 1.
    cerr << boolalpha;
    cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << endl;
-   scan_options (argc, argv);
+   options opts = scan_options (argc, argv);
    bool need_echo = want_echo();
+   // Batch output is flushed when the buffer fills, and only a
+   // terminal session flushes it after every command.
+   cout.flush();
+   ios::sync_with_stdio (false);
+   bool interactive = cout_is_a_tty();
+   output_sink sink (STDOUT_FILENO, interactive);
+   streambuf* saved_buf = cout.rdbuf (&sink);
    inode_state state;
    // Initial shell setup before the primary loop
    // this sets up a "true" root node above the
    // mount point of /.
    // This ensures the property that each directory inode
    // has only subdirectory and file nodes mapped.
-   wordvec slash {"mkdir", "/"};
-   fn_mkdir(state, slash);
-   state.setCwd(state.getCwd()->getContents()->getNode("/"));
-   state.getCwd()->getContents()->remove("..");
+   state.setCwd(state.getCwd()->getContents()->mkdir("/"));
    state.getCwd()->getContents()->setPath("..",state.getCwd());
-   try {
-      for (;;) {
-         try {
-            // Read a line, break at EOF, and echo print the prompt
-            // if one is needed.
-            cout << state.prompt();
-            string line;
-            getline (cin, line);
-            if (cin.eof()) {
-               if (need_echo) cout << "^D";
-               cout << endl;
-               DEBUGF ('y', "EOF");
-               break;
-            }
-            if (need_echo) cout << line << endl;
-
-            // Split the line into words and lookup the appropriate
-            // function.  Complain or call it.
-            wordvec words = split (line, " \t");
-            DEBUGF ('y', "words = " << words);
-            if (words.size() <= 0)
-               continue;
-            command_fn fn = find_command_fn (words.at(0));
-            fn (state, words);
-         }catch (command_error& error) {
-            // If there is a problem discovered in any function, an
-            // exn is thrown and printed here.
-            complain() << error.what() << endl;
-         }
+   if (opts.snapshot != "") {
+      try {
+         snapshot::load (state, opts.snapshot);
+      }catch (file_error& error) {
+         complain() << error.what() << endl;
       }
-   } catch (ysh_exit&) {
-      // This catch intentionally left blank.
    }
-
-   return exit_status_message();
+   if (opts.journal != "") {
+      try {
+         journal::open (state, opts.journal, opts.snapshot);
+      }catch (file_error& error) {
+         complain() << error.what() << endl;
+      }
+   }
+   if (opts.socket != "") {
+      try {
+         server::run (state, opts.socket);
+      }catch (file_error& error) {
+         complain() << error.what() << endl;
+      }
+   }else if (opts.script != "") {
+      run_script (state, opts.script);
+   }else {
+      run_interactive (state, sink, need_echo);
+   }
+   journal::close();
+   int status = exit_status_message();
+   cout.flush();
+   cout.rdbuf (saved_buf);
+   return status;
 }
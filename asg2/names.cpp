@@ -0,0 +1,104 @@
+// $Id: names.cpp,v 1.1 $
+
+#include <cassert>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+using namespace std;
+
+#include "debug.h"
+#include "names.h"
+
+atomic<string*> name_table::chunks[max_chunks];
+atomic<name_id> name_table::count {0};
+atomic<name_table::index*> name_table::ids {nullptr};
+vector<unique_ptr<name_table::index>> name_table::indexes;
+mutex name_table::lock;
+
+// Defined after the table, so that the table is set up first.
+static const bool dots_interned = [] {
+   name_id dot = name_table::intern (".");
+   name_id dotdot = name_table::intern ("..");
+   assert (dot == name_table::dot and dotdot == name_table::dotdot);
+   return true;
+}();
+
+name_table::index::index (size_t size):
+            mask (size - 1), slots (new atomic<name_id>[size]) {
+   for (size_t slot = 0; slot < size; ++slot) {
+      slots[slot].store (no_name, memory_order_relaxed);
+   }
+}
+
+// Linear probing, so a lookup stops at the first empty slot.
+void name_table::index::place (name_id id, memory_order order) {
+   size_t slot = hash<string_view>() (name (id)) & mask;
+   while (slots[slot].load (memory_order_relaxed) != no_name) {
+      slot = (slot + 1) & mask;
+   }
+   slots[slot].store (id, order);
+}
+
+// Fills the new index before publishing it, so a lookup sees
+// either index whole.
+void name_table::grow() {
+   const index* old = ids.load (memory_order_relaxed);
+   size_t size = old == nullptr ? min_index : 2 * (old->mask + 1);
+   auto bigger = make_unique<index> (size);
+   name_id limit = count.load (memory_order_relaxed);
+   for (name_id id = 0; id < limit; ++id) {
+      bigger->place (id, memory_order_relaxed);
+   }
+   ids.store (bigger.get(), memory_order_release);
+   indexes.push_back (move (bigger));
+   DEBUGF ('n', "index of " << size << " slots for " << limit
+          << " names");
+}
+
+name_id name_table::intern (string_view name) {
+   name_id found = find (name);
+   if (found != no_name) return found;
+   lock_guard<mutex> guard (lock);
+   found = find (name);
+   if (found != no_name) return found;
+   name_id id = count.load (memory_order_relaxed);
+   if (id >= chunk_size * max_chunks) {
+      throw length_error ("name_table: too many names");
+   }
+   size_t chunk = id >> chunk_bits;
+   if (chunks[chunk].load (memory_order_relaxed) == nullptr) {
+      chunks[chunk].store (new string[chunk_size], memory_order_release);
+   }
+   string& slot = chunks[chunk].load (memory_order_relaxed)
+                        [id & (chunk_size - 1)];
+   slot.assign (name);
+   // The string is counted before its id is published, so that a
+   // lookup that finds the id can read it.
+   count.store (id + 1, memory_order_release);
+   index* table = ids.load (memory_order_relaxed);
+   if (table == nullptr or 2 * size_t (id + 1) > table->mask + 1) {
+      grow();
+   }else {
+      table->place (id, memory_order_release);
+   }
+   DEBUGF ('n', "intern \"" << name << "\" = " << id);
+   return id;
+}
+
+name_id name_table::find (string_view name) {
+   const index* table = ids.load (memory_order_acquire);
+   if (table == nullptr) return no_name;
+   for (size_t slot = hash<string_view>() (name) & table->mask;;
+        slot = (slot + 1) & table->mask) {
+      name_id id = table->slots[slot].load (memory_order_acquire);
+      if (id == no_name or name_table::name (id) == name) return id;
+   }
+}
+
+const string& name_table::name (name_id id) {
+   assert (id < count.load (memory_order_acquire));
+   return chunks[id >> chunk_bits].load (memory_order_acquire)
+                [id & (chunk_size - 1)];
+}
+
@@ -0,0 +1,89 @@
+// $Id: names.h,v 1.1 $
+
+// names -
+//    Interned pathname components.  Every name that appears in a
+//    directory is stored exactly once, and directories refer to it
+//    by a small integer id.  Looking up a component of a path is
+//    then a hash probe on a string_view followed by integer
+//    compares, with no heap allocation.
+
+#ifndef __NAMES_H__
+#define __NAMES_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+using name_id = uint32_t;
+
+// name_table -
+//    static class holding the interned names.
+// intern -
+//    Returns the id of the name, adding it to the table if it has
+//    not been seen before.
+// find -
+//    Returns the id of the name, or no_name if it has never been
+//    interned.  A name that was never interned can not be in any
+//    directory, so this is a fast negative lookup.
+// name -
+//    Returns the string for an id.  The reference stays valid for
+//    the life of the program.
+// dot, dotdot -
+//    The ids of "." and "..", which are interned before main runs,
+//    so that find knows them before any directory is looked into
+//    and no dirent can be made with either name.
+//
+// Any thread may call these at any time.  Strings are kept in
+// chunks that never move once allocated, so name takes no lock.
+// Ids are kept in an open-addressed index of atomic slots, each
+// filled in once, so find takes no lock either.  intern of a new
+// name takes a mutex, and when the index is half full builds one
+// twice the size and publishes it whole.  Old indexes are kept,
+// since a lookup may still be probing one, and together are never
+// larger than the newest.
+
+class name_table {
+   private:
+      static constexpr size_t chunk_bits = 12;
+      static constexpr size_t chunk_size = size_t (1) << chunk_bits;
+      static constexpr size_t max_chunks = size_t (1) << 16;
+      static atomic<string*> chunks[max_chunks];
+      static atomic<name_id> count;
+      struct index {
+         size_t mask;
+         unique_ptr<atomic<name_id>[]> slots;
+         explicit index (size_t size);
+         void place (name_id id, memory_order order);
+      };
+      static constexpr size_t min_index = 1 << 10;
+      static atomic<index*> ids;
+      static vector<unique_ptr<index>> indexes;
+      static mutex lock;
+      static void grow();
+   public:
+      static constexpr name_id no_name = UINT32_MAX;
+      static constexpr name_id dot = 0;
+      static constexpr name_id dotdot = 1;
+      static name_id intern (string_view name);
+      static name_id find (string_view name);
+      static const string& name (name_id id);
+};
+
+// name_less -
+//    Orders name ids lexicographically by their strings, so that
+//    a map keyed by name_id still prints in sorted order.
+
+struct name_less {
+   bool operator() (name_id left, name_id right) const {
+      return left != right
+         and name_table::name (left) < name_table::name (right);
+   }
+};
+
+#endif
+
@@ -0,0 +1,56 @@
+// $Id: output.cpp,v 1.1 $
+
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "output.h"
+
+output_sink::output_sink (int fd_, bool interactive_, size_t size):
+            fd (fd_), interactive (interactive_), buffer (size) {
+   setp (buffer.data(), buffer.data() + buffer.size());
+}
+
+output_sink::~output_sink() {
+   drain();
+}
+
+// Writes the buffered bytes, retrying short and interrupted
+// writes, and empties the buffer.
+bool output_sink::drain() {
+   const char* next = pbase();
+   const char* end = pptr();
+   while (next < end) {
+      ssize_t written = write (fd, next, end - next);
+      if (written < 0) {
+         if (errno == EINTR) continue;
+         setp (buffer.data(), buffer.data() + buffer.size());
+         return false;
+      }
+      next += written;
+   }
+   setp (buffer.data(), buffer.data() + buffer.size());
+   return true;
+}
+
+output_sink::int_type output_sink::overflow (int_type ch) {
+   if (not drain()) return traits_type::eof();
+   if (traits_type::eq_int_type (ch, traits_type::eof())) {
+      return traits_type::not_eof (ch);
+   }
+   *pptr() = traits_type::to_char_type (ch);
+   pbump (1);
+   return ch;
+}
+
+int output_sink::sync() {
+   return drain() ? 0 : -1;
+}
+
+void output_sink::end_command() {
+   if (interactive) drain();
+}
+
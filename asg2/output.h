@@ -0,0 +1,49 @@
+// $Id: output.h,v 1.1 $
+
+// output -
+//    Buffered standard output.  cout is pointed at an output_sink,
+//    which collects everything the commands print in one large
+//    buffer and hands it to write(2) only when the buffer fills,
+//    when something flushes cout, or, on a terminal, at the end of
+//    each command.  Commands end their lines with '\n' rather than
+//    endl, so a batch run makes one system call per buffer instead
+//    of one per line.
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <streambuf>
+#include <vector>
+using namespace std;
+
+// output_sink -
+// ctor -
+//    Buffers output for the given file descriptor.  If interactive
+//    is set, end_command flushes, so that a person at a terminal
+//    sees each command's output as soon as it is done.
+// end_command -
+//    Called by the main loop between commands.
+// sync -
+//    Writes out whatever is buffered.  Called by flush and endl,
+//    and through cerr's tie whenever an error message is printed,
+//    which keeps errors in order with the output around them.
+
+class output_sink: public streambuf {
+   private:
+      int fd;
+      bool interactive;
+      vector<char> buffer;
+      bool drain();
+   protected:
+      virtual int_type overflow (int_type ch) override;
+      virtual int sync() override;
+   public:
+      output_sink (int fd, bool interactive, size_t size = 1 << 16);
+      output_sink (const output_sink&) = delete;
+      output_sink& operator= (const output_sink&) = delete;
+      virtual ~output_sink();
+      void end_command();
+};
+
+#endif
+
@@ -0,0 +1,97 @@
+// $Id: script.cpp,v 1.2 $
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "script.h"
+
+line_reader::line_reader (int fd_, size_t block_size): fd (fd_) {
+   struct stat info;
+   if (fstat (fd, &info) == 0 and S_ISREG (info.st_mode)
+   and info.st_size > 0) {
+      void* map = mmap (nullptr, info.st_size, PROT_READ,
+                        MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+         madvise (map, info.st_size, MADV_SEQUENTIAL);
+         mapped = static_cast<const char*> (map);
+         mapped_size = info.st_size;
+         end = mapped_size;
+         DEBUGF ('b', "mapped " << mapped_size << " bytes");
+         return;
+      }
+   }
+   buffer.resize (block_size);
+}
+
+line_reader::~line_reader() {
+   if (mapped != nullptr) {
+      munmap (const_cast<char*> (mapped), mapped_size);
+   }
+}
+
+// The whole file is in memory, so a line is just the stretch up to
+// the next newline, or to the end of the mapping.
+bool line_reader::next_mapped (string_view& line) {
+   if (begin == end) return false;
+   const void* newline = memchr (mapped + begin, '\n', end - begin);
+   size_t stop = newline == nullptr
+               ? end : static_cast<const char*> (newline) - mapped;
+   line = string_view (mapped + begin, stop - begin);
+   begin = stop < end ? stop + 1 : end;
+   return true;
+}
+
+// Moves the unread tail to the front of the buffer, doubling the
+// buffer if the tail already fills it, and reads one more block.
+bool line_reader::fill() {
+   if (begin > 0) {
+      memmove (buffer.data(), buffer.data() + begin, end - begin);
+      end -= begin;
+      begin = 0;
+   }
+   if (end == buffer.size()) buffer.resize (buffer.size() * 2);
+   for (;;) {
+      ssize_t count = read (fd, buffer.data() + end,
+                            buffer.size() - end);
+      if (count < 0 and errno == EINTR) continue;
+      if (count < 0) read_failed = true;
+      if (count <= 0) return false;
+      DEBUGF ('b', "read " << count << " bytes");
+      end += count;
+      return true;
+   }
+}
+
+bool line_reader::next (string_view& line) {
+   if (mapped != nullptr) return next_mapped (line);
+   size_t scanned = begin;
+   for (;;) {
+      const char* base = buffer.data();
+      const void* newline = memchr (base + scanned, '\n', end - scanned);
+      if (newline != nullptr) {
+         size_t stop = static_cast<const char*> (newline) - base;
+         line = string_view (base + begin, stop - begin);
+         begin = stop + 1;
+         return true;
+      }
+      if (at_eof) break;
+      scanned = end - begin;
+      if (not fill()) {
+         at_eof = true;
+         break;
+      }
+   }
+   // Last line without a newline.
+   if (begin == end) return false;
+   line = string_view (buffer.data() + begin, end - begin);
+   begin = end;
+   return true;
+}
+
@@ -0,0 +1,53 @@
+// $Id: script.h,v 1.2 $
+
+// script -
+//    Input for the command stream.  A regular file is mapped into
+//    memory whole and handed out a line at a time as views into the
+//    mapping, so reading a multi-million line script neither copies
+//    a byte nor makes a system call per line.  Anything that cannot
+//    be mapped, such as a pipe or a terminal, is read in large
+//    blocks instead, and its lines are views into the block.
+
+#ifndef __SCRIPT_H__
+#define __SCRIPT_H__
+
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// line_reader -
+// ctor -
+//    Reads from an open file descriptor, which it does not close.
+//    Maps it if it is a nonempty regular file, otherwise reads it
+//    in blocks of block_size.
+// next -
+//    Stores a view of the next line, without its newline, in line
+//    and returns true, or returns false at end of file.  The view
+//    is good until the following call.  A line longer than the
+//    buffer makes the buffer grow.
+// failed -
+//    True if a read failed, in which case next returned false.
+
+class line_reader {
+   private:
+      int fd;
+      const char* mapped {nullptr};
+      size_t mapped_size {0};
+      vector<char> buffer;
+      size_t begin {0};
+      size_t end {0};
+      bool at_eof {false};
+      bool read_failed {false};
+      bool fill();
+      bool next_mapped (string_view& line);
+   public:
+      explicit line_reader (int fd, size_t block_size = 1 << 20);
+      ~line_reader();
+      line_reader (const line_reader&) = delete;
+      line_reader& operator= (const line_reader&) = delete;
+      bool next (string_view& line);
+      bool failed() const { return read_failed; }
+};
+
+#endif
+
@@ -0,0 +1,166 @@
+// $Id: server.cpp,v 1.1 $
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <sstream>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "debug.h"
+#include "script.h"
+#include "server.h"
+
+// session -
+//    One connection and the thread that serves it.  The thread
+//    shuts the connection down and sets done as it finishes, and
+//    the server then joins it and closes the connection.
+
+struct session {
+   int fd {-1};
+   thread worker;
+   atomic<bool> done {false};
+};
+
+static atomic<size_t> commands_served {0};
+
+// Written by the signal handler, so that the server's poll wakes.
+static int stop_pipe[2] {-1, -1};
+
+static void stop_handler (int) {
+   char byte = 0;
+   if (write (stop_pipe[1], &byte, 1) < 0) return;
+}
+
+// Output is collected while a command runs and written when it is
+// done, so no command ever waits on a slow client while it holds
+// a lock.
+static void run_session (inode_state& tree, session& self) {
+   inode_state state (tree);
+   ostringstream out;
+   state.setOutput (out, out);
+   auto send = [&out, &self] {
+      string text = out.str();
+      out.str ("");
+      return write_all (self.fd, text.data(), text.size());
+   };
+   line_reader reader (self.fd, 1 << 16);
+   string_view line;
+   viewvec words;
+   try {
+      for (;;) {
+         out << state.prompt();
+         if (not send() or not reader.next (line)) break;
+         split_views (line, " \t", words);
+         if (words.size() <= 0) continue;
+         ++commands_served;
+         execute (state, words);
+      }
+   }catch (ysh_exit&) {
+      send();
+   }
+   DEBUGF ('S', "session on fd " << self.fd << " done");
+   shutdown (self.fd, SHUT_RDWR);
+   self.done = true;
+}
+
+static void reap (list<session>& sessions, bool all) {
+   for (auto itor = sessions.begin(); itor != sessions.end(); ) {
+      if (not all and not itor->done) {
+         ++itor;
+         continue;
+      }
+      itor->worker.join();
+      close (itor->fd);
+      itor = sessions.erase (itor);
+   }
+}
+
+static int open_socket (const string& path) {
+   sockaddr_un address {};
+   address.sun_family = AF_UNIX;
+   if (path.size() >= sizeof address.sun_path) {
+      throw file_error (path + ": socket name too long");
+   }
+   memcpy (address.sun_path, path.c_str(), path.size() + 1);
+   struct stat info;
+   if (lstat (path.c_str(), &info) == 0 and S_ISSOCK (info.st_mode)) {
+      unlink (path.c_str());
+   }
+   int listener = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (listener < 0
+   or bind (listener, reinterpret_cast<sockaddr*> (&address),
+            sizeof address) < 0
+   or listen (listener, SOMAXCONN) < 0) {
+      int error = errno;
+      if (listener >= 0) close (listener);
+      throw file_error (path + ": " + strerror (error));
+   }
+   return listener;
+}
+
+void server::run (inode_state& tree, const string& path) {
+   int listener = open_socket (path);
+   if (pipe (stop_pipe) < 0) {
+      int error = errno;
+      close (listener);
+      unlink (path.c_str());
+      throw file_error (string ("pipe: ") + strerror (error));
+   }
+   struct sigaction stop {};
+   stop.sa_handler = stop_handler;
+   struct sigaction saved_int, saved_term, saved_pipe;
+   sigaction (SIGINT, &stop, &saved_int);
+   sigaction (SIGTERM, &stop, &saved_term);
+   // A client that goes away shows up as a failed write.
+   struct sigaction ignore {};
+   ignore.sa_handler = SIG_IGN;
+   sigaction (SIGPIPE, &ignore, &saved_pipe);
+   cerr << execname() << ": serving on " << path << endl;
+
+   list<session> sessions;
+   size_t served = 0;
+   for (;;) {
+      pollfd ready[] {{listener, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+      int count = poll (ready, 2, -1);
+      if (count < 0 and errno != EINTR) {
+         complain() << "poll: " << strerror (errno) << endl;
+         break;
+      }
+      if (count <= 0) continue;
+      if (ready[1].revents != 0) break;
+      if ((ready[0].revents & POLLIN) == 0) continue;
+      int fd = accept4 (listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) continue;
+      reap (sessions, false);
+      sessions.emplace_back();
+      session& added = sessions.back();
+      added.fd = fd;
+      added.worker = thread (run_session, ref (tree), ref (added));
+      ++served;
+   }
+
+   // Each session sees end of file at its next read.
+   for (session& each: sessions) shutdown (each.fd, SHUT_RDWR);
+   reap (sessions, true);
+   close (listener);
+   unlink (path.c_str());
+   sigaction (SIGINT, &saved_int, nullptr);
+   sigaction (SIGTERM, &saved_term, nullptr);
+   sigaction (SIGPIPE, &saved_pipe, nullptr);
+   close (stop_pipe[0]);
+   close (stop_pipe[1]);
+   cerr << execname() << ": served " << served << " sessions, "
+        << commands_served << " commands" << endl;
+}
+
@@ -0,0 +1,42 @@
+// $Id: server.h,v 1.1 $
+
+// server -
+//    Multi-session mode.  The shell listens on a Unix socket and
+//    runs each connection as a session of its own:  a thread with
+//    its own cwd and prompt, working on the one tree that all of
+//    the sessions share.  A session reads commands from its
+//    connection the way the interactive shell reads a terminal,
+//    prompt and all, and each command's output and error messages
+//    go back to it in one piece once the command is done.  Any
+//    client that can talk to a socket will do, such as
+//       socat - UNIX-CONNECT:socket
+//
+//    Sessions run their commands in parallel.  Path lookups and
+//    listings take no lock at all, writers lock only the
+//    directories they change, and nothing a command unlinks is
+//    freed while another command might still be looking at it.
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <string>
+using namespace std;
+
+#include "file_sys.h"
+
+// server -
+//    static class for the socket server.
+// run -
+//    Serves sessions on the tree until SIGINT or SIGTERM, then
+//    ends every session once its current command is done, removes
+//    the socket, and reports how many sessions and commands were
+//    served.  A socket file left at path by an earlier server is
+//    replaced.  Throws file_error if the socket can not be set up.
+
+class server {
+   public:
+      static void run (inode_state& tree, const string& path);
+};
+
+#endif
+
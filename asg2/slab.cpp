@@ -0,0 +1,61 @@
+// $Id: slab.cpp,v 1.1 $
+
+#include <iostream>
+
+using namespace std;
+
+#include "debug.h"
+#include "slab.h"
+
+slab_pool::slab_pool (size_t chunk_size_):
+            chunk_size (chunk_size_),
+            chunks_per_slab (max<size_t> (64, 65536 / chunk_size_)) {
+}
+
+void slab_pool::grow() {
+   slabs.emplace_back (new char[chunk_size * chunks_per_slab]);
+   next_chunk = slabs.back().get();
+   slab_end = next_chunk + chunk_size * chunks_per_slab;
+   DEBUGF ('s', "chunk_size = " << chunk_size
+          << ", slabs = " << slabs.size());
+}
+
+void* slab_pool::allocate() {
+   if (free_list != nullptr) {
+      free_chunk* chunk = free_list;
+      free_list = chunk->next;
+      return chunk;
+   }
+   if (next_chunk == slab_end) grow();
+   void* chunk = next_chunk;
+   next_chunk += chunk_size;
+   return chunk;
+}
+
+void slab_pool::deallocate (void* chunk) {
+   free_chunk* freed = static_cast<free_chunk*> (chunk);
+   freed->next = free_list;
+   free_list = freed;
+}
+
+void* node_arena::allocate (size_t size) {
+   if (size > max_pooled) return ::operator new (size);
+   size_t size_class = (size + granule - 1) / granule;
+   lock_guard<mutex> guard (lock);
+   if (size_class >= pools.size()) pools.resize (size_class + 1);
+   auto& pool = pools[size_class];
+   if (pool == nullptr) {
+      pool = make_unique<slab_pool> (size_class * granule);
+   }
+   return pool->allocate();
+}
+
+void node_arena::deallocate (void* ptr, size_t size) {
+   if (size > max_pooled) {
+      ::operator delete (ptr);
+      return;
+   }
+   lock_guard<mutex> guard (lock);
+   pools[(size + granule - 1) / granule]->deallocate (ptr);
+}
+
@@ -0,0 +1,98 @@
+// $Id: slab.h,v 1.1 $
+
+// slab -
+//    Pooled allocation for the inode tree.  Inodes and their
+//    contents are small fixed-size objects created and destroyed
+//    in bursts, so each filesystem carves them out of large slabs
+//    instead of asking the heap for every one, and gives all the
+//    slabs back at once when the filesystem goes away.
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+using namespace std;
+
+// slab_pool -
+//    Hands out chunks of one size.  Freed chunks go on a free list
+//    and are reused before the pool takes a new slab.  Slabs are
+//    only released when the pool is destroyed.
+
+class slab_pool {
+   private:
+      struct free_chunk { free_chunk* next; };
+      size_t chunk_size;
+      size_t chunks_per_slab;
+      vector<unique_ptr<char[]>> slabs;
+      free_chunk* free_list {nullptr};
+      char* next_chunk {nullptr};
+      char* slab_end {nullptr};
+      void grow();
+   public:
+      explicit slab_pool (size_t chunk_size);
+      slab_pool (const slab_pool&) = delete;
+      slab_pool& operator= (const slab_pool&) = delete;
+      void* allocate();
+      void deallocate (void* chunk);
+      size_t slab_count() const { return slabs.size(); }
+};
+
+// node_arena -
+//    One slab_pool per size class, owned by a single inode_state.
+//    Requests too large for a size class fall through to the heap.
+//    Sessions that share a tree share its arena, so the pools are
+//    behind a lock.
+
+class node_arena {
+   private:
+      static constexpr size_t granule = 16;
+      static constexpr size_t max_pooled = 512;
+      mutex lock;
+      vector<unique_ptr<slab_pool>> pools;
+   public:
+      node_arena() = default;
+      node_arena (const node_arena&) = delete;
+      node_arena& operator= (const node_arena&) = delete;
+      void* allocate (size_t size);
+      void deallocate (void* ptr, size_t size);
+};
+
+// arena_allocator -
+//    Standard allocator over a node_arena, for use with
+//    allocate_shared so that the object and its shared_ptr control
+//    block come out of the same chunk.
+
+template <typename item_t>
+class arena_allocator {
+   template <typename> friend class arena_allocator;
+   private:
+      node_arena* arena;
+   public:
+      using value_type = item_t;
+      explicit arena_allocator (node_arena& arena_): arena (&arena_) {}
+      template <typename other_t>
+      arena_allocator (const arena_allocator<other_t>& that):
+                      arena (that.arena) {}
+      item_t* allocate (size_t count) {
+         return static_cast<item_t*> (
+                arena->allocate (count * sizeof (item_t)));
+      }
+      void deallocate (item_t* ptr, size_t count) {
+         arena->deallocate (ptr, count * sizeof (item_t));
+      }
+      template <typename other_t>
+      bool operator== (const arena_allocator<other_t>& that) const {
+         return arena == that.arena;
+      }
+      template <typename other_t>
+      bool operator!= (const arena_allocator<other_t>& that) const {
+         return arena != that.arena;
+      }
+};
+
+#endif
+
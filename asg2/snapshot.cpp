@@ -0,0 +1,253 @@
+// $Id: snapshot.cpp,v 1.1 $
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "snapshot.h"
+
+constexpr char snapshot::magic[8];
+
+mapped_file::mapped_file (const string& filename) {
+   int fd = open (filename.c_str(), O_RDONLY);
+   if (fd < 0) throw file_error (filename + ": " + strerror (errno));
+   struct stat info;
+   if (fstat (fd, &info) < 0) {
+      int error = errno;
+      close (fd);
+      throw file_error (filename + ": " + strerror (error));
+   }
+   length = info.st_size;
+   if (length > 0) {
+      void* map = mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) {
+         int error = errno;
+         close (fd);
+         throw file_error (filename + ": " + strerror (error));
+      }
+      base = static_cast<const char*> (map);
+   }
+   close (fd);
+}
+
+mapped_file::~mapped_file() {
+   if (base != nullptr) munmap (const_cast<char*> (base), length);
+}
+
+void snapshot::save (inode_state& state, const string& filename) {
+   inode* slash = state.getRoot()->getContents()->getNode ("/");
+   vector<record> records;
+   string pool;
+   header head {};
+   memcpy (head.magic, magic, sizeof magic);
+   head.version = version;
+
+   // Preorder, with each directory's children pushed in reverse so
+   // that they come off the stack, and go into the file, sorted.
+   // Each directory's dirents are read from the version in use when
+   // the save comes to it, and a file's text is read under the lock
+   // of its directory.
+   struct pending {
+      inode* node;
+      inode* dir;
+      uint32_t parent;
+      name_id name;
+   };
+   vector<pending> stack {{slash, nullptr, no_parent,
+                           name_table::intern ("/")}};
+   while (not stack.empty()) {
+      pending next = stack.back();
+      stack.pop_back();
+      uint32_t number = static_cast<uint32_t> (records.size());
+      if (next.node == state.getCwd()) head.cwd = number;
+      const string& name = name_table::name (next.name);
+      record rec {};
+      rec.parent = next.parent;
+      rec.is_dir = next.node->isDirectory();
+      rec.name_off = pool.size();
+      rec.name_len = static_cast<uint32_t> (name.size());
+      pool += name;
+      if (rec.is_dir) {
+         directory* dir = static_cast<directory*> (next.node->getContents());
+         auto entries = dir->dirents.snapshot();
+         size_t first = stack.size();
+         for (auto itor = entries.begin(); itor != entries.end(); ++itor) {
+            // Mounted snapshots are not saved.
+            if (itor.node()->isDirectory()
+            and itor.node()->getContents()->isReadOnly()) continue;
+            stack.push_back ({itor.node(), next.node, number, itor.name()});
+         }
+         reverse (stack.begin() + first, stack.end());
+      }else {
+         read_lock guard (next.dir->getContents()->getLock());
+         const string& text = next.node->getContents()->readfile().text();
+         rec.text_off = pool.size();
+         rec.text_len = static_cast<uint32_t> (text.size());
+         pool += text;
+      }
+      records.push_back (rec);
+   }
+   head.node_count = static_cast<uint32_t> (records.size());
+   head.prompt_off = pool.size();
+   head.prompt_len = static_cast<uint32_t> (state.prompt().size());
+   pool += state.prompt();
+   head.pool_size = pool.size();
+
+   // The journal is cut back to a checkpoint naming this file once
+   // save returns, so the file and its name must both be on disk by
+   // then:  the data is synced before the rename, and the directory
+   // after it.
+   string tempname = filename + ".tmp";
+   int fd = open (tempname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (fd < 0
+   or not write_all (fd, reinterpret_cast<const char*> (&head),
+                     sizeof head)
+   or not write_all (fd, reinterpret_cast<const char*> (records.data()),
+                     records.size() * sizeof (record))
+   or not write_all (fd, pool.data(), pool.size())
+   or fsync (fd) < 0) {
+      int error = errno;
+      if (fd >= 0) close (fd);
+      unlink (tempname.c_str());
+      throw file_error (tempname + ": " + strerror (error));
+   }
+   close (fd);
+   if (rename (tempname.c_str(), filename.c_str()) < 0) {
+      int error = errno;
+      unlink (tempname.c_str());
+      throw file_error (filename + ": " + strerror (error));
+   }
+   if (not sync_parent (filename)) {
+      throw file_error (filename + ": " + strerror (errno));
+   }
+   DEBUGF ('s', "saved " << records.size() << " inodes, "
+          << pool.size() << " bytes of names and text");
+}
+
+void snapshot::load (inode_state& state, const string& filename) {
+   mapped_file file (filename);
+   auto bad = [&filename] (const char* why) {
+      return file_error (filename + ": bad snapshot: " + why);
+   };
+
+   // Check everything before touching the tree, so a bad file
+   // leaves the current one as it was.
+   header head;
+   if (file.size() < sizeof head) throw bad ("too short");
+   memcpy (&head, file.data(), sizeof head);
+   if (memcmp (head.magic, magic, sizeof magic) != 0) {
+      throw bad ("wrong magic number");
+   }
+   if (head.version != version) throw bad ("wrong version");
+   // Each part is checked against what is left of the file rather
+   // than summed, since a sum of sizes read from it could wrap.
+   uint64_t after_head = file.size() - sizeof head;
+   if (head.node_count == 0
+   or head.node_count > after_head / sizeof (record)) {
+      throw bad ("wrong size");
+   }
+   uint64_t records_size = uint64_t (head.node_count) * sizeof (record);
+   if (head.pool_size != after_head - records_size) {
+      throw bad ("wrong size");
+   }
+   const record* records = reinterpret_cast<const record*> (
+                           file.data() + sizeof head);
+   const char* pool = file.data() + sizeof head + records_size;
+   auto in_pool = [&head] (uint64_t offset, uint64_t length) {
+      return offset <= head.pool_size
+         and length <= head.pool_size - offset;
+   };
+   auto name_of = [records, pool] (uint32_t number) {
+      return string_view (pool + records[number].name_off,
+                          records[number].name_len);
+   };
+   // Siblings must be in strictly increasing order, which also
+   // rules out two dirents with the same name.
+   vector<uint32_t> last_child (head.node_count, no_parent);
+   for (uint32_t number = 0; number < head.node_count; ++number) {
+      const record& rec = records[number];
+      if (not in_pool (rec.name_off, rec.name_len)
+      or not in_pool (rec.text_off, rec.text_len)) {
+         throw bad ("offset out of range");
+      }
+      if (number == 0) {
+         if (rec.parent != no_parent or not rec.is_dir) {
+            throw bad ("first inode is not /");
+         }
+         continue;
+      }
+      if (rec.parent >= number or not records[rec.parent].is_dir) {
+         throw bad ("parent is not an earlier directory");
+      }
+      string_view name = name_of (number);
+      if (name.empty() or name.find ('/') != string_view::npos) {
+         throw bad ("invalid name");
+      }
+      uint32_t& previous = last_child[rec.parent];
+      if (previous != no_parent and not (name_of (previous) < name)) {
+         throw bad ("dirents out of order");
+      }
+      previous = number;
+   }
+   if (head.cwd >= head.node_count or not records[head.cwd].is_dir) {
+      throw bad ("cwd is not a directory");
+   }
+   if (not in_pool (head.prompt_off, head.prompt_len)) {
+      throw bad ("offset out of range");
+   }
+
+   // Empty /, then rebuild it.  Each record's parent was made
+   // before it, so one pass turns record numbers into inodes.
+   // Siblings are in order, so each dirent is added at the end.
+   // Another session may take a name in / before the subtree of
+   // that name is linked in, in which case the subtree is dropped,
+   // left as nullptr here, and so is everything under it.
+   inode* slash = state.getRoot()->getContents()->getNode ("/");
+   state.setCwd (slash);
+   {
+      write_lock guard (slash->getContents()->getLock());
+      for (const string& name: slash->getContents()->getAllPaths()) {
+         if (name != "." and name != "..") {
+            slash->getContents()->rmtree (name);
+         }
+      }
+   }
+   vector<inode*> nodes (head.node_count, nullptr);
+   nodes[0] = slash;
+   tree_builder builder;
+   vector<uint32_t> tops;
+   for (uint32_t number = 1; number < head.node_count; ++number) {
+      const record& rec = records[number];
+      if (nodes[rec.parent] == nullptr) continue;
+      if (rec.parent == 0) tops.push_back (number);
+      nodes[number] = builder.add (nodes[rec.parent], name_of (number),
+                         rec.is_dir ? file_type::DIRECTORY_TYPE
+                                    : file_type::PLAIN_TYPE,
+                         rec.text_len == 0 ? file_data()
+                         : file_data (string_view (pool + rec.text_off,
+                                                   rec.text_len)));
+   }
+   builder.finish();
+   for (uint32_t number: tops) {
+      if (nodes[number] == nullptr or builder.was_dropped (nodes[number])) {
+         nodes[number] = nullptr;
+         complain (state.errors()) << filename << ": " << name_of (number)
+                                   << ": file exists, not loaded" << endl;
+      }
+   }
+   uint32_t cwd = head.cwd;
+   while (cwd != 0 and nodes[cwd] != nullptr) cwd = records[cwd].parent;
+   state.setCwd (cwd == 0 ? nodes[head.cwd] : slash);
+   state.setPrompt (string (pool + head.prompt_off, head.prompt_len));
+   DEBUGF ('s', "loaded " << head.node_count << " inodes from "
+          << filename);
+}
+
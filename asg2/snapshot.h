@@ -0,0 +1,86 @@
+// $Id: snapshot.h,v 1.1 $
+
+// snapshot -
+//    Saves the whole tree under / to a compact binary file and
+//    restores it, so a large tree need not be rebuilt by replaying
+//    the script that made it.
+//
+//    The file is a header, then one fixed size record per inode in
+//    preorder, then a pool holding every name and every file's
+//    text.  Records refer to their parent by record number and to
+//    their bytes by offset into the pool, so the file has no
+//    pointers in it.  Loading maps the file once and makes a single
+//    pass over the records, turning each parent number into the
+//    inode already made for it.  Names and text are copied
+//    straight out of the mapping, with no parsing.
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "file_sys.h"
+
+// mapped_file -
+//    A read only mapping of a whole file, unmapped by the dtor so
+//    that every way out of the code reading it lets go of it.
+//    Throws file_error if the file can not be opened or mapped.
+
+class mapped_file {
+   private:
+      const char* base {nullptr};
+      size_t length {0};
+   public:
+      explicit mapped_file (const string& filename);
+      ~mapped_file();
+      mapped_file (const mapped_file&) = delete;
+      mapped_file& operator= (const mapped_file&) = delete;
+      const char* data() const { return base; }
+      size_t size() const { return length; }
+};
+
+// snapshot -
+//    static class for saving and loading the tree.
+// save -
+//    Writes the tree under /, the cwd, and the prompt to filename,
+//    replacing it only once the new file is complete.
+//    Mounted snapshots are left out.
+// load -
+//    Replaces everything under / with the tree in filename, and
+//    restores the cwd and the prompt.  The file is checked before
+//    the current tree is touched.  Other server sessions see / empty
+//    and then each subtree of it appear whole.
+//
+// Both throw file_error on failure.
+
+class snapshot {
+   private:
+      static constexpr char magic[8] {'y','s','h','s','n','a','p','\0'};
+      static constexpr uint32_t version = 1;
+      static constexpr uint32_t no_parent = UINT32_MAX;
+      struct header {
+         char magic[8];
+         uint32_t version;
+         uint32_t node_count;
+         uint32_t cwd;
+         uint32_t prompt_len;
+         uint64_t prompt_off;
+         uint64_t pool_size;
+      };
+      struct record {
+         uint32_t parent;
+         uint32_t is_dir;
+         uint32_t name_len;
+         uint32_t text_len;
+         uint64_t name_off;
+         uint64_t text_off;
+      };
+   public:
+      static void save (inode_state& state, const string& filename);
+      static void load (inode_state& state, const string& filename);
+};
+
+#endif
+
@@ -1,6 +1,8 @@
 // $Id: util.cpp,v 1.11 2016-01-13 16:21:53-08 - - $
 
+#include <cerrno>
 #include <cstdlib>
+#include <fcntl.h>
 #include <unistd.h>
 
 using namespace std;
@@ -8,7 +10,7 @@ using namespace std;
 #include "util.h"
 #include "debug.h"
 
-int exit_status::status = EXIT_SUCCESS;
+atomic<int> exit_status::status {EXIT_SUCCESS};
 static string execname_string;
 
 void exit_status::set (int new_status) {
@@ -28,11 +30,16 @@ string& execname() {
    return execname_string;
 }
 
+constexpr int CIN_FD {0};
+constexpr int COUT_FD {1};
+
+bool cout_is_a_tty() {
+   return isatty (COUT_FD);
+}
+
 bool want_echo() {
-   constexpr int CIN_FD {0};
-   constexpr int COUT_FD {1};
    bool cin_is_not_a_tty = not isatty (CIN_FD);
-   bool cout_is_not_a_tty = not isatty (COUT_FD);
+   bool cout_is_not_a_tty = not cout_is_a_tty();
    DEBUGF ('u', "cin_is_not_a_tty = " << cin_is_not_a_tty
           << ", cout_is_not_a_tty = " << cout_is_not_a_tty);
    return cin_is_not_a_tty or cout_is_not_a_tty;
@@ -55,9 +62,74 @@ wordvec split (const string& line, const string& delimiters) {
    return words;
 }
 
-ostream& complain() {
+viewvec split_views (string_view line, string_view delimiters) {
+   viewvec words;
+   split_views (line, delimiters, words);
+   return words;
+}
+
+void split_views (string_view line, string_view delimiters,
+                  viewvec& words) {
+   words.clear();
+   size_t end = 0;
+   for (;;) {
+      size_t start = line.find_first_not_of (delimiters, end);
+      if (start == string_view::npos) break;
+      end = line.find_first_of (delimiters, start);
+      if (end == string_view::npos) end = line.size();
+      words.push_back (line.substr (start, end - start));
+   }
+   DEBUGF ('u', words);
+}
+
+bool path_walker::next (string_view& component) {
+   size_t start = path.find_first_not_of ('/', pos);
+   if (start == string_view::npos) {
+      pos = path.size();
+      return false;
+   }
+   size_t end = path.find ('/', start);
+   if (end == string_view::npos) end = path.size();
+   component = path.substr (start, end - start);
+   pos = end;
+   return true;
+}
+
+pair<string_view,string_view> split_last (string_view path) {
+   size_t end = path.find_last_not_of ('/');
+   if (end == string_view::npos) return {path, string_view()};
+   size_t slash = path.rfind ('/', end);
+   size_t start = slash == string_view::npos ? 0 : slash + 1;
+   return {path.substr (0, start), path.substr (start, end + 1 - start)};
+}
+
+bool write_all (int fd, const char* data, size_t size) {
+   while (size > 0) {
+      ssize_t count = write (fd, data, size);
+      if (count < 0 and errno == EINTR) continue;
+      if (count < 0) return false;
+      data += count;
+      size -= count;
+   }
+   return true;
+}
+
+bool sync_parent (const string& path) {
+   size_t slash = path.rfind ('/');
+   string dir = slash == string::npos ? "."
+              : slash == 0 ? "/" : path.substr (0, slash);
+   int fd = open (dir.c_str(), O_RDONLY | O_DIRECTORY);
+   if (fd < 0) return false;
+   bool synced = fsync (fd) == 0;
+   int error = errno;
+   close (fd);
+   errno = error;
+   return synced;
+}
+
+ostream& complain (ostream& out) {
    exit_status::set (EXIT_FAILURE);
-   cerr << execname() << ": ";
-   return cerr;
+   out << execname() << ": ";
+   return out;
 }
 
@@ -7,9 +7,11 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
+#include <atomic>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 using namespace std;
 
@@ -20,6 +22,8 @@ using range_type = pair<iterator,iterator>;
 
 using wordvec = vector<string>;
 using word_range = range_type<decltype(declval<wordvec>().cbegin())>;
+using viewvec = vector<string_view>;
+using view_range = range_type<viewvec::const_iterator>;
 
 // setexecname -
 //    Sets the static string to be used as an execname.
@@ -37,6 +41,12 @@ string& execname();
 
 bool want_echo();
 
+// cout_is_a_tty -
+//    Whether standard output is a terminal, which decides whether
+//    output is flushed after every command.
+
+bool cout_is_a_tty();
+
 // exit_status -
 //    A static class for maintaining the exit status.  The default
 //    status is EXIT_SUCCESS (0), but can be set to another value,
@@ -45,7 +55,7 @@ bool want_echo();
 
 class exit_status {
    private:
-      static int status;
+      static atomic<int> status;
    public:
       static void set (int);
       static int get();
@@ -59,13 +69,62 @@ class exit_status {
 
 wordvec split (const string& line, const string& delimiter);
 
+// split_views -
+//    Like split, but the words are views into line, so nothing is
+//    copied.  The views are only good as long as line is unchanged.
+//    The second form clears and refills words, so a caller that
+//    keeps one viewvec across lines does no allocation once it has
+//    grown to the longest line.
+
+viewvec split_views (string_view line, string_view delimiters);
+void split_views (string_view line, string_view delimiters,
+                  viewvec& words);
+
+// path_walker -
+//    Steps through the components of a pathname without copying
+//    them.  Each call to next stores a view of the following
+//    component into its argument and returns false when the path
+//    is exhausted.  Runs of slashes are skipped, just as split
+//    does, so "a//b/" walks "a" then "b".
+
+class path_walker {
+   private:
+      string_view path;
+      size_t pos {0};
+   public:
+      explicit path_walker (string_view path_): path (path_) {}
+      bool next (string_view& component);
+};
+
+// split_last -
+//    Splits a pathname into the directory part and the final
+//    component, both as views into the argument.  Trailing slashes
+//    are ignored.  The final component is empty if the path has
+//    no components at all.
+
+pair<string_view,string_view> split_last (string_view path);
+
+// write_all -
+//    Writes all of data to fd, retrying short writes and EINTR.
+//    Returns false, with errno set, if a write fails.
+
+bool write_all (int fd, const char* data, size_t size);
+
+// sync_parent -
+//    Syncs the directory that holds path, so that a file just
+//    renamed into it is still there after a crash.  Returns false,
+//    with errno set, if it can not.
+
+bool sync_parent (const string& path);
+
 // complain -
 //    Used for starting error messages.  Sets the exit status to
 //    EXIT_FAILURE, writes the program name to cerr, and then
 //    returns the cerr ostream.  Example:
 //       complain() << filename << ": some problem" << endl;
+//    A server session passes the stream of its connection instead.
 
-ostream& complain();
+ostream& complain (ostream& out = cerr);
 
 // operator<< (vector) -
 //    An overloaded template operator which allows vectors to be
@@ -0,0 +1,109 @@
+// $Id: workpool.cpp,v 1.1 $
+
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+#include "debug.h"
+#include "workpool.h"
+
+// The pool the calling thread works for, if any, and the index of
+// its own queue there.
+static thread_local const work_pool* home_pool {nullptr};
+static thread_local size_t home_index {0};
+
+work_pool::work_pool (size_t threads) {
+   if (threads == 0) threads = 1;
+   for (size_t index = 0; index < threads; ++index) {
+      queues.push_back (make_unique<worker_queue>());
+   }
+   for (size_t index = 0; index < threads; ++index) {
+      workers.emplace_back (&work_pool::work, this, index);
+   }
+   DEBUGF ('p', "threads = " << threads);
+}
+
+work_pool::~work_pool() {
+   {
+      lock_guard<mutex> guard (idle_lock);
+      stopping = true;
+   }
+   idle.notify_all();
+   for (auto& worker: workers) worker.join();
+}
+
+void work_pool::submit (task_group& group, function<void()> fn) {
+   ++group.pending;
+   size_t index = home_pool == this ? home_index
+                : next_queue++ % queues.size();
+   {
+      lock_guard<mutex> guard (queues[index]->lock);
+      queues[index]->tasks.emplace_back (move (fn), &group);
+   }
+   {
+      lock_guard<mutex> guard (idle_lock);
+      ++queued;
+   }
+   idle.notify_one();
+}
+
+// Looks in the home queue first, newest end, then steals from the
+// oldest end of the others.
+bool work_pool::take (size_t home, task& found) {
+   size_t count = queues.size();
+   for (size_t offset = 0; offset < count; ++offset) {
+      worker_queue& queue = *queues[(home + offset) % count];
+      lock_guard<mutex> guard (queue.lock);
+      if (queue.tasks.empty()) continue;
+      if (offset == 0) {
+         found = move (queue.tasks.back());
+         queue.tasks.pop_back();
+      }else {
+         found = move (queue.tasks.front());
+         queue.tasks.pop_front();
+      }
+      --queued;
+      return true;
+   }
+   return false;
+}
+
+void work_pool::run (task& found) {
+   found.first();
+   if (--found.second->pending == 0) {
+      lock_guard<mutex> guard (idle_lock);
+      idle.notify_all();
+   }
+}
+
+void work_pool::work (size_t index) {
+   home_pool = this;
+   home_index = index;
+   for (;;) {
+      task found;
+      if (take (index, found)) {
+         run (found);
+         continue;
+      }
+      unique_lock<mutex> guard (idle_lock);
+      idle.wait (guard, [this] { return stopping or queued > 0; });
+      if (stopping) return;
+   }
+}
+
+void work_pool::wait (task_group& group) {
+   size_t home = home_pool == this ? home_index : 0;
+   while (group.pending > 0) {
+      task found;
+      if (take (home, found)) {
+         run (found);
+         continue;
+      }
+      unique_lock<mutex> guard (idle_lock);
+      idle.wait_for (guard, chrono::milliseconds (1), [this, &group] {
+         return group.pending == 0 or queued > 0;
+      });
+   }
+}
+
@@ -0,0 +1,72 @@
+// $Id: workpool.h,v 1.1 $
+
+// workpool -
+//    A small work-stealing thread pool.  Each worker owns a deque
+//    of tasks, runs its own newest task first, and when it runs
+//    out steals the oldest task of some other worker.  Tasks are
+//    grouped so that a caller can wait for just the work it
+//    started, running queued tasks itself while it waits.
+
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// task_group -
+//    Counts the tasks submitted under it that have not finished.
+
+class task_group {
+   friend class work_pool;
+   private:
+      atomic<size_t> pending {0};
+};
+
+// work_pool -
+// ctor -
+//    Starts the given number of worker threads.
+// submit -
+//    Queues a task under a group.  From a worker thread the task
+//    goes on that worker's own deque.
+// wait -
+//    Returns when every task in the group has finished, running
+//    tasks from the pool in the meantime.
+// size -
+//    The number of worker threads.
+
+class work_pool {
+   private:
+      using task = pair<function<void()>,task_group*>;
+      struct worker_queue {
+         mutex lock;
+         deque<task> tasks;
+      };
+      vector<unique_ptr<worker_queue>> queues;
+      vector<thread> workers;
+      atomic<size_t> queued {0};
+      atomic<size_t> next_queue {0};
+      atomic<bool> stopping {false};
+      mutex idle_lock;
+      condition_variable idle;
+      bool take (size_t home, task& found);
+      void run (task& found);
+      void work (size_t index);
+   public:
+      explicit work_pool (size_t threads);
+      work_pool (const work_pool&) = delete;
+      work_pool& operator= (const work_pool&) = delete;
+      ~work_pool();
+      void submit (task_group& group, function<void()> fn);
+      void wait (task_group& group);
+      size_t size() const { return workers.size(); }
+};
+
+#endif
+